@@ -52,14 +52,44 @@ int main(int argc, char **argv) {
               << std::endl;
     return EXIT_FAILURE;
   }
-  if(dir_list.size() > 2) {
-    std::cout << "Only TARGET_DIR and CHECK_DIR should be provided."
-              << std::endl;
-    return EXIT_FAILURE;
-  }
-
   fii::init_homedir_and_subdirs();
 
+  // a folder provided more than once (e.g. fii dir1 dir1) is processed only
+  // once and folders nested inside another folder (e.g. a folder and its
+  // subfolder) are processed by the N folder mode which decodes every image
+  // file only once
+  std::vector<std::string> canonical_dir_list;
+  std::vector<std::string> unique_dir_list;
+  for(std::size_t k=0; k<dir_list.size(); ++k) {
+    std::string canonical_dir = fii::fs_realpath(dir_list[k]);
+    if(canonical_dir == "") {
+      canonical_dir = dir_list[k];
+    }
+    bool is_duplicate = false;
+    for(std::size_t j=0; j<unique_dir_list.size(); ++j) {
+      if(canonical_dir == canonical_dir_list[j] ||
+         fii::fs_is_same_file(dir_list[k], unique_dir_list[j])) {
+        std::cout << "Skipping " << dir_list[k] << " as it is same as "
+                  << unique_dir_list[j] << std::endl;
+        is_duplicate = true;
+        break;
+      }
+    }
+    if(!is_duplicate) {
+      unique_dir_list.push_back(dir_list[k]);
+      canonical_dir_list.push_back(canonical_dir);
+    }
+  }
+  dir_list.swap(unique_dir_list);
+  bool has_nested_dir = false;
+  for(std::size_t k=0; k<canonical_dir_list.size(); ++k) {
+    for(std::size_t j=0; j<canonical_dir_list.size(); ++j) {
+      if(j != k && canonical_dir_list[k].compare(0, canonical_dir_list[j].size(), canonical_dir_list[j]) == 0) {
+        has_nested_dir = true;
+      }
+    }
+  }
+
   // use all available threads by default
   int nthread = omp_get_max_threads();
   if(options.count("nthread")) {
@@ -71,7 +101,66 @@ int main(int argc, char **argv) {
 
   if(options.count("check-all-pixels")) {
     std::cout << "Performing exhaustive comparison of every pixels "
-              << "(this is slower and requires more memory)" << std::endl;
+              << "(this is slower)" << std::endl;
+  }
+  if(options.count("check-tiers")) {
+    std::vector<std::string> tier_names;
+    if(!fii_parse_check_tiers(options["check-tiers"], tier_names)) {
+      return EXIT_FAILURE;
+    }
+    std::cout << "Verifying candidates using tiers: "
+              << options["check-tiers"] << std::endl;
+  }
+
+  if(options.count("max-pixel-diff") || options.count("max-diff-fraction")) {
+    fii_tolerance tolerance;
+    if(!fii_parse_tolerance(options, tolerance)) {
+      std::cout << "--max-pixel-diff must be an integer between 0 and 255 and "
+                << "--max-diff-fraction must be a number between 0 and 1" << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "Finding near identical images with at most "
+              << (tolerance.max_diff_fraction * 100.0) << "% of pixel values "
+              << "differing by more than " << tolerance.max_pixel_diff << std::endl;
+  }
+  uint64_t pixel_cache_size;
+  if(!fii_parse_pixel_cache_size(options, pixel_cache_size)) {
+    std::cout << "--pixel-cache must be an integer between 0 and " << FII_PIXEL_CACHE_SIZE_MAX
+              << " (in MB)" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if(options.count("sample-grid")) {
+    if(fii_sample_grid_size(options) == 0) {
+      std::cout << "--sample-grid must be an integer between 1 and " << FII_SAMPLE_GRID_MAX
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "Sampling pixel values on a " << options["sample-grid"] << "x"
+              << options["sample-grid"] << " grid" << std::endl;
+  }
+
+  bool merge_rotated_dim = options.count("flip-rotate") != 0;
+  if(merge_rotated_dim) {
+    if(options.count("max-pixel-diff") || options.count("max-diff-fraction")) {
+      std::cout << "--flip-rotate cannot be used to find near identical images"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "Finding identical images that are flipped or rotated copies"
+              << std::endl;
+  }
+  if(options.count("match-gray")) {
+    std::cout << "Matching grayscale images stored using three colour channels "
+              << "with grayscale images" << std::endl;
+  }
+  if(options.count("near-identical")) {
+    if(fii_hamming_radius(options) == -1) {
+      std::cout << "--hamming-radius must be an integer between 0 and " << FII_PHASH_RADIUS_MAX
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "Finding near identical images whose perceptual hash differ in at most "
+              << fii_hamming_radius(options) << " bits" << std::endl;
   }
 
   std::string check_dir1(dir_list.at(0));
@@ -87,13 +176,20 @@ int main(int argc, char **argv) {
                              filename_list1,
                              buckets_of_img_index1,
                              bucket_img_dim_list1,
-                             bucket_id_list1);
+                             bucket_id_list1,
+                             true,
+                             merge_rotated_dim);
 
   // save histogram of images grouped by their dimension
   //std::string hist1_fn = cache_dir1 + dir1_name + "-img-dimension-histogram.csv";
   //fii_save_img_dimension_histogram(buckets_of_img_index1, bucket_id_list1, hist1_fn);
 
-  if(dir_list.size() == 2) {
+  if(dir_list.size() > 2 || has_nested_dir) {
+    // find identical images between N folders
+    fii_find_identical_img_in_folders(dir_list, canonical_dir_list, has_nested_dir,
+                                      filename_list1, buckets_of_img_index1, bucket_img_dim_list1,
+                                      cache_dir1, options, tstart);
+  } else if(dir_list.size() == 2) {
     // find identical images between check_dir1 and check_dir2
     std::string check_dir2(dir_list.at(1));
     std::string dir2_name = fii::fs_dirname(check_dir2);
@@ -108,19 +204,36 @@ int main(int argc, char **argv) {
                                filename_list2,
                                buckets_of_img_index2,
                                bucket_img_dim_list2,
-                               bucket_id_list2);
+                               bucket_id_list2,
+                               true,
+                               merge_rotated_dim);
 
     // save histogram of images grouped by their dimension
     //std::string hist2_fn = cache_dir2 + dir2_name + "-img-dimension-histogram.csv";
     //fii_save_img_dimension_histogram(buckets_of_img_index2, bucket_id_list2, hist2_fn);
 
     uint32_t identical_img_count = 0;
+    fii_img_name_fn img_name = fii_export_img_name_fn(filename_list1, check_dir1, filename_list2, check_dir2);
     std::set<std::string> set_of_bucket_id2;
     for(uint32_t bindex=0; bindex!=bucket_id_list2.size(); ++bindex) {
       set_of_bucket_id2.insert(bucket_id_list2.at(bindex));
     }
 
+    // filter of CHECK_DIR2 saved by a previous run avoids decoding images in
+    // CHECK_DIR2 when no image in CHECK_DIR1 can have an identical copy
+    std::unordered_map<std::string, fii_bloom_filter> filters2;
+    if(options.count("dir2-filter")) {
+      if(fii_bloom_filter_load(options["dir2-filter"], filters2)) {
+        std::cout << "Loaded filter of " << filters2.size()
+                  << " image dimensions from " << options["dir2-filter"] << std::endl;
+      }
+    }
+
     std::unordered_map<std::string, std::vector<std::set<uint32_t> > > image_groups;
+    std::unordered_map<std::string, fii_img_signatures> signatures;
+    bool has_signatures = options.count("match-gray") || options.count("find-resized") ||
+      options.count("near-identical") || options.count("find-crops");
+    fii_match_stats match_stats;
     for(uint32_t bindex=0; bindex!=bucket_id_list1.size(); ++bindex) {
       std::string bucket_id = bucket_id_list1.at(bindex);
       if(set_of_bucket_id2.count(bucket_id) == 0) {
@@ -134,16 +247,9 @@ int main(int argc, char **argv) {
       }
 
       std::vector<std::set<uint32_t> > bucket_image_groups;
-      // if check_all_pixels is requested, use the following two pass approach:
-      // Pass 1. first compute identical images using sparse features
-      // Pass 2. find identical images found in step [1] using exhaustive pixelwise search
-      // this avoids running exhaustive pixelwise search on all images
-      bool check_all_pixels = false;
-      if(options.count("check-all-pixels")) {
-	check_all_pixels = true;
-	options.erase("check-all-pixels");
-      }
-      // Pass 1 
+      // if check_all_pixels is requested, a hash of all pixel values is
+      // computed while the image is decoded to compute its sparse features
+      // and therefore every image is decoded only once
       fii_find_identical_img(filename_list1,
                              buckets_of_img_index1[bucket_id],
                              check_dir1,
@@ -152,40 +258,11 @@ int main(int argc, char **argv) {
                              check_dir2,
                              bucket_img_dim_list1[bucket_id],
                              options,
-                             bucket_image_groups);
-      if(check_all_pixels) {
-	// Pass 2
-	std::vector<uint32_t> filename_index_list1_pass2;
-	std::vector<uint32_t> filename_index_list2_pass2;
-        std::vector<std::set<uint32_t> >::const_iterator gi;
-        for(std::size_t group_id=0; group_id<bucket_image_groups.size(); ++group_id) {
-          std::set<uint32_t> group_members(bucket_image_groups.at(group_id));
-          std::set<uint32_t>::const_iterator si;
-          for(si=group_members.begin(); si!=group_members.end(); ++si) {
-            uint32_t findex = *si;
-            if(findex >= filename_list1.size()) {
-              // findex is from check_dir2
-              findex = findex - filename_list1.size();
-	      filename_index_list2_pass2.push_back(findex);
-            } else {
-              // findex is from check_dir1
-	      filename_index_list1_pass2.push_back(findex);
-	    }
-          }
-        }
-	bucket_image_groups.clear();
-	options["check-all-pixels"] = "";
-	fii_find_identical_img(filename_list1,
-			       filename_index_list1_pass2,
-			       check_dir1,
-			       filename_list2,
-			       filename_index_list2_pass2,
-			       check_dir2,
-			       bucket_img_dim_list1[bucket_id],
-			       options,
-			       bucket_image_groups);
-      }
-      
+                             bucket_image_groups,
+                             &match_stats,
+                             options.count("dir2-filter") ? &filters2[bucket_id] : NULL,
+                             has_signatures ? &signatures[bucket_id] : NULL);
+
       if(bucket_image_groups.size()) {
         image_groups[bucket_id] = bucket_image_groups;
 
@@ -194,37 +271,66 @@ int main(int argc, char **argv) {
                   << std::endl;
 
         for(std::size_t group_id=0; group_id<bucket_image_groups.size(); ++group_id) {
-          std::set<uint32_t> group_members(bucket_image_groups.at(group_id));
-          std::set<uint32_t>::const_iterator si;
-          std::cout << "  [" << group_id << "] : ";
-          for(si=group_members.begin(); si!=group_members.end(); ++si) {
-            uint32_t findex = *si;
-            std::string filename;
-            std::string dir_name;
-            if(findex >= filename_list1.size()) {
-              // findex is from check_dir2
-              findex = findex - filename_list1.size();
-              filename = filename_list2.at(findex);
-              dir_name = dir2_name + "/";
-            } else {
-              // findex is from check_dir1
-              filename = filename_list1.at(findex);
-              dir_name = dir1_name + "/";
-            }
-            if(si!= group_members.begin()) {
-              std::cout << ", " << dir_name << filename;
-            } else {
-              std::cout << "" << dir_name << filename;
-            }
-          }
-
-          identical_img_count += group_members.size() - 1;
-          std::cout << std::endl;
+          fii_show_img_group("", group_id, bucket_image_groups[group_id], img_name);
+          identical_img_count += bucket_image_groups[group_id].size() - 1;
         }
       }
     }
+
+    std::unordered_map<std::string, std::vector<uint32_t> > bucket_img_dim_list(bucket_img_dim_list1);
+    bucket_img_dim_list.insert(bucket_img_dim_list2.begin(), bucket_img_dim_list2.end());
+    if(has_signatures) {
+      // buckets that were not compared above (e.g. present in only one
+      // folder) can still contain identical grayscale or resized images
+      std::set<std::string> signature_bucket_id_list = fii_signature_bucket_id_list(bucket_img_dim_list1,
+                                                                                    bucket_img_dim_list2,
+                                                                                    signatures,
+                                                                                    options);
+      fii_compute_img_signatures(filename_list1, check_dir1, 0,
+                                 buckets_of_img_index1, bucket_img_dim_list1,
+                                 signature_bucket_id_list, options, signatures);
+      fii_compute_img_signatures(filename_list2, check_dir2, filename_list1.size(),
+                                 buckets_of_img_index2, bucket_img_dim_list2,
+                                 signature_bucket_id_list, options, signatures);
+    }
+    if(options.count("match-gray")) {
+      std::vector<std::pair<std::string, uint32_t> > joined_groups;
+      identical_img_count += fii_join_gray_buckets(signatures, bucket_img_dim_list, options,
+                                                   filename_list1, check_dir1,
+                                                   filename_list2, check_dir2,
+                                                   image_groups, joined_groups);
+      if(joined_groups.size()) {
+        std::cout << "Grayscale images stored using three colour channels" << std::endl;
+      }
+      for(std::size_t ji=0; ji<joined_groups.size(); ++ji) {
+        fii_show_img_group(joined_groups[ji].first + " ", joined_groups[ji].second,
+                           image_groups[joined_groups[ji].first].at(joined_groups[ji].second),
+                           img_name);
+      }
+    }
+    std::vector<std::set<uint32_t> > resized_groups;
+    if(options.count("find-resized")) {
+      fii_find_resized_img(signatures, options,
+                           filename_list1, check_dir1,
+                           filename_list2, check_dir2,
+                           resized_groups);
+      fii_show_img_groups("Resized copies", resized_groups, img_name);
+    }
+    std::vector<std::set<uint32_t> > near_groups;
+    if(options.count("near-identical")) {
+      fii_find_near_identical_img(signatures, options, filename_list1.size(),
+                                  image_groups, near_groups);
+      fii_show_img_groups("Near identical images", near_groups, img_name);
+    }
     std::cout << std::endl;
 
+    if(options.count("dir2-filter")) {
+      if(fii_bloom_filter_save(filters2, options["dir2-filter"])) {
+        std::cout << "Saved filter of " << check_dir2 << " to "
+                  << options["dir2-filter"] << std::endl;
+      }
+    }
+
     uint32_t tend = fii::getmillisecs();
     double elapsed_sec = ((double)(tend - tstart)) / 1000.0;
 
@@ -237,6 +343,12 @@ int main(int argc, char **argv) {
       std::cout << "Discarded " << buckets_of_img_index2["0x0x0"].size()
                 << " malformed images in " << check_dir2 << std::endl;
     }
+    fii_show_undecodable_files(match_stats);
+    fii_show_file_copy_stats(match_stats);
+    if(options.count("check-all-pixels") || options.count("check-tiers") ||
+       options.count("max-pixel-diff") || options.count("max-diff-fraction")) {
+      fii_show_match_stats(match_stats);
+    }
 
     std::cout << "Processed two folders with " << filename_list1.size()
               << " and " << filename_list2.size() << " images in "
@@ -245,19 +357,69 @@ int main(int argc, char **argv) {
     if(image_groups.size()) {
       std::cout << "Found " << identical_img_count << " identical images."
                 << std::endl;
+    } else {
+      std::cout << "Identical images not found." << std::endl;
+    }
+    if(near_groups.size()) {
+      std::cout << "Found " << near_groups.size() << " sets of near identical images."
+                << std::endl;
+    }
+    if(image_groups.size() || near_groups.size()) {
       std::string export_dir = cache_dir1;
       if(options.count("export")) {
         export_dir = options.at("export");
       }
-      fii_export_all(image_groups, export_dir, filename_list1, check_dir1, filename_list2, check_dir2);
-    } else {
-      std::cout << "Identical images not found." << std::endl;
+      fii_export_all(image_groups, export_dir, filename_list1, check_dir1, filename_list2, check_dir2, near_groups);
+    }
+
+    if(resized_groups.size()) {
+      uint32_t resized_img_count = 0;
+      for(std::size_t group_id=0; group_id<resized_groups.size(); ++group_id) {
+        resized_img_count += resized_groups[group_id].size() - 1;
+      }
+      std::string export_dir = cache_dir1;
+      if(options.count("export")) {
+        export_dir = options.at("export");
+      }
+      std::unordered_map<std::string, std::vector<std::set<uint32_t> > > resized_img_groups = { {"resized", resized_groups} };
+      std::string csv_fn = export_dir + dir1_name + "-" + dir2_name + "-resized.csv";
+      fii_export_csv(resized_img_groups, csv_fn,
+                     fii_export_img_name_fn(filename_list1, check_dir1, filename_list2, check_dir2));
+      std::cout << "Found " << resized_img_count << " resized copies, saved to "
+                << csv_fn << std::endl;
+    }
+
+    if(options.count("find-crops")) {
+      std::vector<fii_crop_file> crop_files;
+      fii_crop_add_files(filename_list1, check_dir1, 0, buckets_of_img_index1, crop_files);
+      fii_crop_add_files(filename_list2, check_dir2, filename_list1.size(), buckets_of_img_index2, crop_files);
+      std::vector<uint32_t> folder_findex_offset = { 0, (uint32_t) filename_list1.size() };
+      std::vector<std::string> img_name;
+      for(std::size_t i=0; i<filename_list1.size(); ++i) {
+        img_name.push_back(dir1_name + "/" + filename_list1[i]);
+      }
+      for(std::size_t i=0; i<filename_list2.size(); ++i) {
+        img_name.push_back(dir2_name + "/" + filename_list2[i]);
+      }
+      std::string export_dir = cache_dir1;
+      if(options.count("export")) {
+        export_dir = options.at("export");
+      }
+      fii_find_img_crops(crop_files, signatures, folder_findex_offset, img_name,
+                         export_dir + dir1_name + "-" + dir2_name + "-crops.csv");
     }
   } else {
     // find identical images within check_dir1
     bool is_first_entry = true;
     uint32_t identical_img_count = 0;
+    fii_img_name_fn img_name = [&filename_list1](uint32_t findex) -> std::string {
+      return filename_list1.at(findex);
+    };
     std::unordered_map<std::string, std::vector<std::set<uint32_t> > > image_groups;
+    std::unordered_map<std::string, fii_img_signatures> signatures;
+    bool has_signatures = options.count("match-gray") || options.count("find-resized") ||
+      options.count("near-identical") || options.count("find-crops");
+    fii_match_stats match_stats;
     for(uint32_t bindex=0; bindex!=bucket_id_list1.size(); ++bindex) {
       std::string bucket_id = bucket_id_list1.at(bindex);
       if(bucket_id == "0x0x0") {
@@ -266,44 +428,18 @@ int main(int argc, char **argv) {
       }
 
       std::vector<std::set<uint32_t> > bucket_image_groups;
-
-      // if check_all_pixels is requested, use the following two pass approach:
-      // Pass 1. first compute identical images using sparse features
-      // Pass 2. find identical images found in step [1] using exhaustive pixelwise search
-      // this avoids running exhaustive pixelwise search on all images
-      bool check_all_pixels = false;
-      if(options.count("check-all-pixels")) {
-	check_all_pixels = true;
-	options.erase("check-all-pixels");
-      }
-      // Pass 1 
+      // if check_all_pixels is requested, a hash of all pixel values is
+      // computed while the image is decoded to compute its sparse features
+      // and therefore every image is decoded only once
       fii_find_identical_img(filename_list1,
                              buckets_of_img_index1[bucket_id],
                              check_dir1,
                              bucket_img_dim_list1[bucket_id],
                              options,
-                             bucket_image_groups);
-      if(check_all_pixels) {
-	// Pass 2
-	std::vector<uint32_t> filename_index_list1_pass2;
-        std::vector<std::set<uint32_t> >::const_iterator gi;
-        for(std::size_t group_id=0; group_id!=bucket_image_groups.size(); ++group_id) {
-          std::set<uint32_t> group_members(bucket_image_groups.at(group_id));
-          std::set<uint32_t>::const_iterator si;
-          for(si=group_members.begin(); si!=group_members.end(); ++si) {
-	    filename_index_list1_pass2.push_back(*si);
-	  }
-	}
-	bucket_image_groups.clear();
-	options["check-all-pixels"] = "";
-	fii_find_identical_img(filename_list1,
-			       filename_index_list1_pass2,
-			       check_dir1,
-			       bucket_img_dim_list1[bucket_id],
-			       options,
-			       bucket_image_groups);
-      }
-      
+                             bucket_image_groups,
+                             &match_stats,
+                             has_signatures ? &signatures[bucket_id] : NULL);
+
       if(bucket_image_groups.size()) {
         image_groups[bucket_id] = bucket_image_groups;
 
@@ -311,25 +447,52 @@ int main(int argc, char **argv) {
                   << " (checked " << buckets_of_img_index1[bucket_id].size() << " images)"
                   << std::endl;
 
-        std::vector<std::set<uint32_t> >::const_iterator gi;
         for(std::size_t group_id=0; group_id!=bucket_image_groups.size(); ++group_id) {
-          std::set<uint32_t> group_members(bucket_image_groups.at(group_id));
-          std::set<uint32_t>::const_iterator si;
-          std::cout << "  [" << group_id << "] : ";
-          for(si=group_members.begin(); si!=group_members.end(); ++si) {
-            uint32_t findex = *si;
-            if(si!= group_members.begin()) {
-              std::cout << ", " << filename_list1.at(findex);
-            } else {
-              std::cout << filename_list1.at(findex);
-            }
-          }
-          std::cout << std::endl;
-
-          identical_img_count += group_members.size() - 1;
+          fii_show_img_group("", group_id, bucket_image_groups[group_id], img_name);
+          identical_img_count += bucket_image_groups[group_id].size() - 1;
         }
       }
     }
+
+    if(has_signatures) {
+      // a bucket containing a single image is not compared above but can
+      // contain an image identical to (or resized copy of) other images
+      std::set<std::string> signature_bucket_id_list = fii_signature_bucket_id_list(bucket_img_dim_list1,
+                                                                                    bucket_img_dim_list1,
+                                                                                    signatures,
+                                                                                    options);
+      fii_compute_img_signatures(filename_list1, check_dir1, 0,
+                                 buckets_of_img_index1, bucket_img_dim_list1,
+                                 signature_bucket_id_list, options, signatures);
+    }
+    if(options.count("match-gray")) {
+      std::vector<std::pair<std::string, uint32_t> > joined_groups;
+      identical_img_count += fii_join_gray_buckets(signatures, bucket_img_dim_list1, options,
+                                                   filename_list1, check_dir1,
+                                                   std::vector<std::string>(), "",
+                                                   image_groups, joined_groups);
+      if(joined_groups.size()) {
+        std::cout << "Listing grayscale images stored using three colour channels" << std::endl;
+      }
+      for(std::size_t ji=0; ji<joined_groups.size(); ++ji) {
+        fii_show_img_group(joined_groups[ji].first + " ", joined_groups[ji].second,
+                           image_groups[joined_groups[ji].first].at(joined_groups[ji].second),
+                           img_name);
+      }
+    }
+    std::vector<std::set<uint32_t> > resized_groups;
+    if(options.count("find-resized")) {
+      fii_find_resized_img(signatures, options,
+                           filename_list1, check_dir1,
+                           std::vector<std::string>(), "",
+                           resized_groups);
+      fii_show_img_groups("Listing resized copies", resized_groups, img_name);
+    }
+    std::vector<std::set<uint32_t> > near_groups;
+    if(options.count("near-identical")) {
+      fii_find_near_identical_img(signatures, options, 0, image_groups, near_groups);
+      fii_show_img_groups("Listing near identical images", near_groups, img_name);
+    }
     std::cout << std::endl;
     uint32_t tend = fii::getmillisecs();
     double elapsed_sec = ((double)(tend - tstart)) / 1000.0;
@@ -340,6 +503,12 @@ int main(int argc, char **argv) {
       std::cout << "Discarded " << buckets_of_img_index1["0x0x0"].size()
                 << " malformed images in " << check_dir1 << std::endl;
     }
+    fii_show_undecodable_files(match_stats);
+    fii_show_file_copy_stats(match_stats);
+    if(options.count("check-all-pixels") || options.count("check-tiers") ||
+       options.count("max-pixel-diff") || options.count("max-diff-fraction")) {
+      fii_show_match_stats(match_stats);
+    }
 
     if(image_groups.size()) {
       // @todo: remove non-portable Linux console colour code
@@ -349,11 +518,6 @@ int main(int argc, char **argv) {
 		<< elapsed_sec << "s)"
 		<< "\033[0m"
 		<< std::endl;
-      std::string export_dir = cache_dir1;
-      if(options.count("export")) {
-        export_dir = options.at("export");
-      }
-      fii_export_all(image_groups, export_dir, filename_list1, check_dir1);
     } else {
       // @todo: remove non-portable Linux console colour code
       std::cout << "\033[0;32m"
@@ -363,6 +527,47 @@ int main(int argc, char **argv) {
 		<< "\033[0m"
 		<< std::endl;
     }
+    if(near_groups.size()) {
+      std::cout << "Found " << near_groups.size() << " sets of near identical images."
+                << std::endl;
+    }
+    if(image_groups.size() || near_groups.size()) {
+      std::string export_dir = cache_dir1;
+      if(options.count("export")) {
+        export_dir = options.at("export");
+      }
+      fii_export_all(image_groups, export_dir, filename_list1, check_dir1,
+                     std::vector<std::string>(), "", near_groups);
+    }
+
+    if(resized_groups.size()) {
+      uint32_t resized_img_count = 0;
+      for(std::size_t group_id=0; group_id<resized_groups.size(); ++group_id) {
+        resized_img_count += resized_groups[group_id].size() - 1;
+      }
+      std::string export_dir = cache_dir1;
+      if(options.count("export")) {
+        export_dir = options.at("export");
+      }
+      std::unordered_map<std::string, std::vector<std::set<uint32_t> > > resized_img_groups = { {"resized", resized_groups} };
+      std::string csv_fn = export_dir + dir1_name + "-resized.csv";
+      fii_export_csv(resized_img_groups, csv_fn,
+                     fii_export_img_name_fn(filename_list1, check_dir1, std::vector<std::string>(), ""));
+      std::cout << "Found " << resized_img_count << " resized copies, saved to "
+                << csv_fn << std::endl;
+    }
+
+    if(options.count("find-crops")) {
+      std::vector<fii_crop_file> crop_files;
+      fii_crop_add_files(filename_list1, check_dir1, 0, buckets_of_img_index1, crop_files);
+      std::vector<uint32_t> folder_findex_offset = { 0 };
+      std::string export_dir = cache_dir1;
+      if(options.count("export")) {
+        export_dir = options.at("export");
+      }
+      fii_find_img_crops(crop_files, signatures, folder_findex_offset, filename_list1,
+                         export_dir + dir1_name + "-crops.csv");
+    }
   }
   return EXIT_SUCCESS;
 }
@@ -13,10 +13,17 @@
 
 #include <sstream>
 #include <cmath>
+#include <cerrno>
+#include <cstdlib>
 #include <set>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <random>
 
 #ifndef STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -24,25 +31,838 @@
 #include "stb_image.h"
 #endif
 
+#include "fii_hash.h"
+#include "fii_union_find.h"
+#include "fii_simd.h"
+#include "fii_bloom_filter.h"
+#include "fii_crop.h"
+#include "fii_pixel_cache.h"
+
 // a sparse sample of pixel values are compared
 // if W and H are the image width and image height respectively
 // then pixel value features are extracted from the following pixel locations
 // for x in FII_IMG_FEATURE_LOC_SCALE .* W
 //   for y in FII_IMG_FEATURE_LOC_SCALE .* H
-//      PUSH feature_list, IMAGE(x,y)
+//     for c in 0 ... NCHANNEL-1
+//       PUSH feature_list, IMAGE(x,y,c)
 const std::vector<float> FII_IMG_FEATURE_LOC_SCALE {0.1, 0.2, 0.25, 0.3, 0.35, 0.4, 0.45, 0.5, 0.55, 0.6, 0.65, 0.7, 0.75, 0.8, 0.9};
 
-void fii_depth_first_search(const std::unordered_map<uint32_t, std::set<uint32_t> > &match_graph,
-                            std::unordered_map<uint32_t, uint8_t> &vertex_flag,
-                            uint32_t vertex,
-                            std::set<uint32_t> &visited_nodes);
+// --sample-grid=N samples pixel values on a N x N grid of pixel locations
+// evenly spaced in the image (the default grid uses FII_IMG_FEATURE_LOC_SCALE)
+const uint32_t FII_SAMPLE_GRID_DEFAULT = 15;
+const uint32_t FII_SAMPLE_GRID_MAX = 256;
+const int FII_SAMPLE_GRID_DEFAULT_COUNT = FII_SAMPLE_GRID_DEFAULT * FII_SAMPLE_GRID_DEFAULT;
+
+// With --adapt-sampling, the same number of pixel values are sampled from
+// the locations (and colour channels) of a FII_ADAPTIVE_SAMPLING_GRID_SIZE x
+// FII_ADAPTIVE_SAMPLING_GRID_SIZE grid that vary the most in a random subset
+// of FII_ADAPTIVE_SAMPLING_IMG_COUNT images of a bucket. This avoids sampling
+// uniform borders, letterboxing or watermarks shared by many images. Only
+// buckets with at least FII_ADAPTIVE_SAMPLING_MIN_IMG_COUNT images are
+// sampled as the random subset of images is decoded one more time.
+const uint32_t FII_ADAPTIVE_SAMPLING_GRID_SIZE = 64;
+const uint32_t FII_ADAPTIVE_SAMPLING_IMG_COUNT = 32;
+const uint32_t FII_ADAPTIVE_SAMPLING_MIN_IMG_COUNT = 1024;
+const uint32_t FII_ADAPTIVE_SAMPLING_SEED = 9973;
+
+// Candidate identical images found using the sparse features (pass 1) are
+// verified (pass 2) using a cascade of tiers where each tier only compares
+// the images that survived the previous tier. The signature of each tier is
+// computed while the image is decoded for its sparse features and stored
+// after the sparse features in the feature row of each image.
+//   grid    : 64 bit hash of pixel values (all channels) on a 64x64 grid
+//   rowhash : 64 bit hash of all the pixel values in 64 evenly spaced rows
+//   hash    : 128 bit hash of all the pixel values
+//   exact   : decode the images again and compare all their pixel values
+const uint32_t FII_CHECK_TIER_GRID_SIZE = 64;
+const uint32_t FII_CHECK_TIER_ROW_COUNT = 64;
+const std::string FII_CHECK_TIERS_DEFAULT = "hash,exact";
+
+// With --max-pixel-diff=D and --max-diff-fraction=F, two images are near
+// identical if at most a fraction F of their pixel values differ by more than
+// D. Candidates are images that have the same coarse signature (average pixel
+// values of a FII_COARSE_GRID_SIZE x FII_COARSE_GRID_SIZE grid of blocks,
+// quantised to FII_COARSE_LEVEL_COUNT levels) and their sparse features are
+// allowed to differ in twice as many values as F. The exact tier compares all
+// pixel values of the candidates using the same tolerance.
+//
+// Neighbouring keys are not probed: a block average close to a level boundary
+// (i.e. 64, 128 or 192) can be quantised to different levels for an image and
+// its near identical copy, and such pairs are not found. Probing the keys of
+// all neighbouring levels would put an image in up to 2^12 partitions of pass
+// 1 (and in as many keys of a saved filter), which costs more than the missed
+// pairs that mostly have large flat regions at a level boundary.
+const uint32_t FII_COARSE_GRID_SIZE = 2;
+const uint32_t FII_COARSE_LEVEL_COUNT = 4;
+
+// With --flip-rotate, images are compared using their canonical image which is
+// same for an image and its flipped or rotated (by multiple of 90 degrees)
+// copies. The canonical image is the lexicographically smallest image among
+// the transforms of an image in the dihedral group (i.e. 4 rotations, with
+// and without flip) that are in landscape orientation. Therefore, an image
+// of dimension WxH is compared with the images of dimension HxW.
+
+// With --match-gray, grayscale images stored using three colour channels (i.e.
+// all channels have same value) are matched with the grayscale images of the
+// same width and height. While the images of WxHx1 and WxHx3 buckets are
+// decoded, a gray signature (a flag byte followed by 128 bit hash of the
+// single channel form) is stored in their feature row and groups of the two
+// buckets are joined by looking up these hash values.
+const uint32_t FII_GRAY_SIGNATURE_SIZE = 17;
+
+struct fii_gray_signature {
+  uint32_t findex;
+  uint64_t hash[2];
+};
+
+// With --find-resized, resized copies of an image are found using a
+// FII_THUMBNAIL_SIZE x FII_THUMBNAIL_SIZE thumbnail (mean of all pixel values
+// in each cell) computed while an image is decoded. Thumbnails are indexed by
+// their values on a coarser grid (FII_RESIZED_KEY_GRID_SIZE) quantised to
+// FII_RESIZED_KEY_LEVEL_COUNT levels and a value within
+// FII_RESIZED_KEY_MARGIN of a level boundary is also looked up in the
+// neighbouring level. Images with similar thumbnails are verified by
+// resampling the larger image to the dimension of the smaller image and
+// comparing their pixel values.
+const uint32_t FII_THUMBNAIL_SIZE = 8;
+const uint32_t FII_THUMBNAIL_VALUE_COUNT = FII_THUMBNAIL_SIZE * FII_THUMBNAIL_SIZE;
+const uint32_t FII_RESIZED_KEY_GRID_SIZE = 4;
+const uint32_t FII_RESIZED_KEY_LEVEL_COUNT = 8;
+const uint32_t FII_RESIZED_KEY_MARGIN = 4;
+const uint32_t FII_RESIZED_MAX_PROBE_CELL = 8;   // at most 2^8 keys per image
+const uint32_t FII_RESIZED_MIN_CONTRAST = 16;    // nearly uniform images are not indexed
+const double FII_RESIZED_MAX_THUMBNAIL_DIFF = 8.0;
+const double FII_RESIZED_MAX_ASPECT_DIFF = 0.02;
+const double FII_RESIZED_MAX_MEAN_DIFF = 6.0;
+const uint32_t FII_RESIZED_MAX_KEY_IMG_COUNT = 4096; // larger keys are skipped
+const uint32_t FII_RESIZED_PAIR_BATCH_SIZE = 1024; // candidate pairs verified together
+
+// With --near-identical, a 64 bit perceptual hash (the sign of the 8x8 lowest
+// frequency DCT coefficients of a FII_PHASH_THUMBNAIL_SIZE x
+// FII_PHASH_THUMBNAIL_SIZE gray thumbnail relative to their median) is computed
+// while an image is decoded. All pairs of images whose hash differ in at most
+// --hamming-radius bits are found using multi-index hashing: the hash is split
+// into m substrings and, as two hashes within radius r have at least one
+// substring within radius r/m, only the images whose substring is within this
+// (smaller) radius in one of the m sorted tables are compared.
+const uint32_t FII_PHASH_THUMBNAIL_SIZE = 32;
+const uint32_t FII_PHASH_SIZE = 8;
+const uint32_t FII_PHASH_RADIUS_DEFAULT = 6;
+const uint32_t FII_PHASH_RADIUS_MAX = 16;
+const uint32_t FII_PHASH_MIN_SUBSTRING_BITS = 16;
+const uint32_t FII_PHASH_MAX_SUBSTRING_BITS = 32;
+
+struct fii_phash {
+  uint32_t findex;
+  uint64_t hash;
+};
+
+struct fii_thumbnail {
+  uint32_t findex;
+  uint32_t width;
+  uint32_t height;
+  uint32_t nchannel;
+  uint8_t value[FII_THUMBNAIL_VALUE_COUNT];
+};
+
+// signatures computed (for other buckets) while the images of a bucket are
+// decoded to find identical images
+struct fii_img_signatures {
+  std::vector<fii_gray_signature> gray;
+  std::vector<fii_thumbnail> thumbnail;
+  std::vector<fii_phash> phash;
+  std::vector<fii_crop_img> crop;
+};
+
+struct fii_tolerance {
+  uint32_t max_pixel_diff = 0;
+  double max_diff_fraction = 0.0;
+};
+
+bool fii_is_tolerant(const fii_tolerance &tolerance) {
+  return tolerance.max_pixel_diff || tolerance.max_diff_fraction > 0.0;
+}
+
+// number of pixel values allowed to differ by more than max_pixel_diff
+uint64_t fii_max_diff_count(const fii_tolerance &tolerance,
+                            const uint64_t value_count) {
+  return (uint64_t) std::floor(tolerance.max_diff_fraction * value_count);
+}
+
+// parse an integer (or a real number) option value, values with leftover
+// characters (e.g. "5px") or that are out of range are invalid
+bool fii_parse_long(const std::string &value,
+                    long &number) {
+  char *end = NULL;
+  errno = 0;
+  number = std::strtol(value.c_str(), &end, 10);
+  return !value.empty() && errno == 0 && *end == '\0';
+}
+
+bool fii_parse_double(const std::string &value,
+                      double &number) {
+  char *end = NULL;
+  errno = 0;
+  number = std::strtod(value.c_str(), &end);
+  return !value.empty() && errno == 0 && *end == '\0' && !std::isnan(number);
+}
+
+// -1 if the value of --hamming-radius is invalid
+int fii_hamming_radius(const std::unordered_map<std::string, std::string> &options) {
+  if(options.count("hamming-radius") == 0) {
+    return FII_PHASH_RADIUS_DEFAULT;
+  }
+  long radius = 0;
+  if(!fii_parse_long(options.at("hamming-radius"), radius) ||
+     radius < 0 || radius > (long) FII_PHASH_RADIUS_MAX) {
+    return -1;
+  }
+  return (int) radius;
+}
+
+// parse tolerance options (returns false for invalid values)
+bool fii_parse_tolerance(const std::unordered_map<std::string, std::string> &options,
+                         fii_tolerance &tolerance) {
+  tolerance = fii_tolerance();
+  if(options.count("max-pixel-diff")) {
+    long max_pixel_diff = 0;
+    if(!fii_parse_long(options.at("max-pixel-diff"), max_pixel_diff) ||
+       max_pixel_diff < 0 || max_pixel_diff > 255) {
+      return false;
+    }
+    tolerance.max_pixel_diff = max_pixel_diff;
+  }
+  if(options.count("max-diff-fraction")) {
+    if(!fii_parse_double(options.at("max-diff-fraction"), tolerance.max_diff_fraction) ||
+       tolerance.max_diff_fraction < 0.0 || tolerance.max_diff_fraction > 1.0) {
+      tolerance = fii_tolerance();
+      return false;
+    }
+  }
+  return true;
+}
+
+struct fii_check_tier {
+  std::string name;
+  uint32_t offset;              // location of tier signature in a feature row
+  uint32_t size;                // size of tier signature (in bytes)
+};
+
+// layout of the feature row of each image in a bucket of image dimension
+struct fii_feature_layout {
+  uint32_t width;
+  uint32_t height;
+  uint32_t nchannel;
+
+  // sampling plan: sample_unit bytes (i.e. all channels of a pixel location or
+  // a single pixel value) are copied from each offset of the decoded image
+  uint32_t sample_unit;
+  std::vector<uint64_t> sample_offset;
+
+  uint32_t sparse_feature_count;
+  uint32_t sparse_feature_stride; // sparse features padded for SIMD kernels
+
+  // images are partitioned (pass 1) using the hash of key_count bytes at
+  // key_offset of the feature row (sparse features or coarse signature)
+  fii_tolerance tolerance;
+  uint32_t key_offset;
+  uint32_t key_count;
+
+  bool is_dihedral;              // features computed from canonical image
+  uint32_t gray_offset;          // location of gray signature (0 if unused)
+  uint32_t thumbnail_offset;     // location of thumbnail (0 if unused)
+  uint32_t phash_offset;         // location of perceptual hash (0 if unused)
+  uint32_t crop_offset;          // location of crop anchor (0 if unused)
+
+  std::vector<fii_check_tier> tiers;
+  uint32_t img_feature_count;
+  uint32_t img_feature_stride;
+};
+
+// grid size requested using --sample-grid (0 for invalid value)
+uint32_t fii_sample_grid_size(const std::unordered_map<std::string, std::string> &options) {
+  if(options.count("sample-grid") == 0) {
+    return FII_SAMPLE_GRID_DEFAULT;
+  }
+  long grid_size = 0;
+  if(!fii_parse_long(options.at("sample-grid"), grid_size) ||
+     grid_size < 1 || grid_size > (long) FII_SAMPLE_GRID_MAX) {
+    return 0;
+  }
+  return grid_size;
+}
+
+// The sampling plan of a grid of pixel locations is computed only once for all
+// images in a bucket. The order of sparse feature values (x major, then y and
+// colour channel) is same as the one used by earlier versions and therefore
+// saved filters (see fii_bloom_filter.h) remain valid.
+void fii_init_sample_grid(const uint32_t grid_size,
+                          fii_feature_layout &layout) {
+  std::vector<uint64_t> xp, yp;
+  for(uint32_t i=0; i<grid_size; ++i) {
+    if(grid_size == FII_SAMPLE_GRID_DEFAULT) {
+      xp.push_back( uint32_t(layout.width  * FII_IMG_FEATURE_LOC_SCALE.at(i)) );
+      yp.push_back( uint32_t(layout.height * FII_IMG_FEATURE_LOC_SCALE.at(i)) );
+    } else {
+      xp.push_back( (((uint64_t) layout.width)  * (i + 1)) / (grid_size + 1) );
+      yp.push_back( (((uint64_t) layout.height) * (i + 1)) / (grid_size + 1) );
+    }
+  }
+  layout.sample_unit = layout.nchannel;
+  layout.sample_offset.clear();
+  for(uint32_t xi=0; xi<grid_size; ++xi) {
+    for(uint32_t yi=0; yi<grid_size; ++yi) {
+      layout.sample_offset.push_back((yp[yi] * layout.width + xp[xi]) * layout.nchannel);
+    }
+  }
+  layout.sparse_feature_count = grid_size * grid_size * layout.nchannel;
+}
+
+uint32_t fii_check_tier_size(const std::string tier_name) {
+  if(tier_name == "grid" || tier_name == "rowhash") {
+    return 8;
+  }
+  if(tier_name == "hash") {
+    return 16;
+  }
+  return 0; // exact
+}
+
+// parse a comma separated list of tiers (e.g. "grid,hash,exact")
+bool fii_parse_check_tiers(const std::string tier_list,
+                           std::vector<std::string> &tier_names) {
+  tier_names.clear();
+  fii::split(tier_list, ',', tier_names);
+  for(std::size_t i=0; i<tier_names.size(); ++i) {
+    const std::string &name = tier_names[i];
+    if(name != "grid" && name != "rowhash" && name != "hash" && name != "exact") {
+      std::cout << "Unknown tier [" << name << "] in --check-tiers" << std::endl;
+      return false;
+    }
+    if(name == "exact" && i != (tier_names.size() - 1)) {
+      std::cout << "The exact tier must be the last tier in --check-tiers" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// tiers are enabled by --check-tiers or, with default tiers, by --check-all-pixels
+// while all pixel values of near identical images are always compared
+void fii_init_feature_layout(const std::vector<uint32_t> &img_dim,
+                             const std::unordered_map<std::string, std::string> &options,
+                             fii_feature_layout &layout) {
+  layout.width = img_dim[0];
+  layout.height = img_dim[1];
+  layout.nchannel = img_dim[2];
+  layout.is_dihedral = options.count("flip-rotate") != 0;
+  fii_init_sample_grid(fii_sample_grid_size(options), layout);
+  layout.sparse_feature_stride = fii_feature_stride(layout.sparse_feature_count);
+  layout.tiers.clear();
+
+  std::vector<std::string> tier_names;
+  fii_parse_tolerance(options, layout.tolerance);
+  if(fii_is_tolerant(layout.tolerance)) {
+    tier_names.push_back("exact");
+  } else if(options.count("check-tiers")) {
+    fii_parse_check_tiers(options.at("check-tiers"), tier_names);
+  } else if(options.count("check-all-pixels")) {
+    fii_parse_check_tiers(FII_CHECK_TIERS_DEFAULT, tier_names);
+  }
+
+  uint32_t offset = layout.sparse_feature_stride;
+  layout.key_offset = 0;
+  layout.key_count = layout.sparse_feature_count;
+  if(fii_is_tolerant(layout.tolerance)) {
+    layout.key_offset = offset;
+    layout.key_count = FII_COARSE_GRID_SIZE * FII_COARSE_GRID_SIZE * layout.nchannel;
+    offset += layout.key_count;
+  }
+  layout.gray_offset = 0;
+  if(options.count("match-gray") && (layout.nchannel == 1 || layout.nchannel == 3)) {
+    layout.gray_offset = offset;
+    offset += FII_GRAY_SIGNATURE_SIZE;
+  }
+  layout.thumbnail_offset = 0;
+  if(options.count("find-resized") &&
+     layout.width >= FII_THUMBNAIL_SIZE && layout.height >= FII_THUMBNAIL_SIZE) {
+    layout.thumbnail_offset = offset;
+    offset += FII_THUMBNAIL_VALUE_COUNT;
+  }
+  layout.phash_offset = 0;
+  if(options.count("near-identical") &&
+     layout.width >= FII_PHASH_THUMBNAIL_SIZE && layout.height >= FII_PHASH_THUMBNAIL_SIZE) {
+    layout.phash_offset = offset;
+    offset += sizeof(uint64_t);
+  }
+  layout.crop_offset = 0;
+  if(options.count("find-crops") &&
+     layout.width >= FII_CROP_WINDOW_SIZE && layout.height >= FII_CROP_WINDOW_SIZE) {
+    layout.crop_offset = offset;
+    offset += FII_CROP_SIGNATURE_SIZE;
+  }
+  for(std::size_t i=0; i<tier_names.size(); ++i) {
+    fii_check_tier tier;
+    tier.name = tier_names[i];
+    tier.offset = offset;
+    tier.size = fii_check_tier_size(tier.name);
+    offset += tier.size;
+    layout.tiers.push_back(tier);
+  }
+  layout.img_feature_count = offset;
+  layout.img_feature_stride = fii_feature_stride(layout.img_feature_count);
+}
+
+bool fii_has_exact_tier(const fii_feature_layout &layout) {
+  return layout.tiers.size() && layout.tiers.back().name == "exact";
+}
+
+// key used to partition images in pass 1
+uint64_t fii_feature_key(const fii_feature_layout &layout,
+                         const uint8_t *feature) {
+  return fii_hash64(feature + layout.key_offset, layout.key_count);
+}
+
+// statistics of the two pass search accumulated over all image dimensions
+struct fii_match_stats {
+  uint64_t pass1_candidate_count = 0; // images with same sparse features as another image
+  uint64_t pass2_rejected_count  = 0; // pass 1 candidates that differ in some pixel value
+
+  // cost model of each tier (tier 0 is the sparse features)
+  std::vector<std::string> tier_name;
+  std::vector<uint64_t> tier_checked_count;  // images compared by this tier
+  std::vector<uint64_t> tier_rejected_count; // images rejected by this tier
+  std::vector<uint64_t> tier_value_count;    // pixel values read for this tier
+
+  uint64_t byte_identical_count = 0; // byte-for-byte copies that were not decoded
+  uint64_t hardlink_count = 0;       // links to an already listed file
+  uint64_t pixel_cache_hit_count = 0; // pass 2 images not decoded again
+  std::vector<std::string> undecodable_file_list; // excluded from matching
+};
+
+// memory budget (in bytes) of the cache of pixels decoded in pass 1 (returns
+// false for an invalid value of --pixel-cache)
+bool fii_parse_pixel_cache_size(const std::unordered_map<std::string, std::string> &options,
+                                uint64_t &size) {
+  size = FII_PIXEL_CACHE_SIZE_DEFAULT << 20;
+  if(options.count("pixel-cache") == 0) {
+    return true;
+  }
+  long size_mb = 0;
+  if(!fii_parse_long(options.at("pixel-cache"), size_mb) ||
+     size_mb < 0 || size_mb > (long) FII_PIXEL_CACHE_SIZE_MAX) {
+    size = 0;
+    return false;
+  }
+  size = ((uint64_t) size_mb) << 20;
+  return true;
+}
+
+uint64_t fii_pixel_cache_size(const std::unordered_map<std::string, std::string> &options) {
+  uint64_t size;
+  fii_parse_pixel_cache_size(options, size);
+  return size;
+}
+
+uint32_t fii_match_stats_tier(fii_match_stats &stats,
+                              const std::string name) {
+  for(uint32_t i=0; i<stats.tier_name.size(); ++i) {
+    if(stats.tier_name[i] == name) {
+      return i;
+    }
+  }
+  stats.tier_name.push_back(name);
+  stats.tier_checked_count.push_back(0);
+  stats.tier_rejected_count.push_back(0);
+  stats.tier_value_count.push_back(0);
+  return stats.tier_name.size() - 1;
+}
+
+// Identical images must have identical features and therefore, the same hash
+// of their features. Sorting images by the hash of their features ensures
+// that all candidate identical images appear as a consecutive run in the
+// sorted list. This avoids comparing all possible pairs of images.
+void fii_sort_by_feature_key(const fii_feature_vector &features,
+                             const fii_feature_layout &layout,
+                             std::vector<uint64_t> &feature_key,
+                             std::vector<uint32_t> &sorted_index) {
+  uint32_t img_count = features.size() / layout.img_feature_stride;
+  feature_key.resize(img_count);
+  sorted_index.resize(img_count);
+#pragma omp parallel for
+  for(uint32_t i=0; i<img_count; ++i) {
+    feature_key[i] = fii_feature_key(layout, &features[((uint64_t) i) * layout.img_feature_stride]);
+    sorted_index[i] = i;
+  }
+  std::sort(sorted_index.begin(), sorted_index.end(),
+            [&feature_key](const uint32_t a, const uint32_t b) {
+              if(feature_key[a] == feature_key[b]) {
+                return a < b;
+              }
+              return feature_key[a] < feature_key[b];
+            });
+}
+
+// find runs [start, end) of images that have the same feature key
+void fii_find_candidate_runs(const std::vector<uint64_t> &feature_key,
+                             const std::vector<uint32_t> &sorted_index,
+                             std::vector<std::pair<uint32_t, uint32_t> > &runs) {
+  runs.clear();
+  uint32_t img_count = sorted_index.size();
+  uint32_t run_start = 0;
+  while(run_start < img_count) {
+    uint64_t key = feature_key[ sorted_index[run_start] ];
+    uint32_t run_end = run_start + 1;
+    while(run_end < img_count && feature_key[ sorted_index[run_end] ] == key) {
+      ++run_end;
+    }
+    runs.push_back(std::make_pair(run_start, run_end));
+    run_start = run_end;
+  }
+}
+
+// Candidate runs are compared in parallel: each thread takes a tile of
+// FII_CANDIDATE_RUN_TILE consecutive runs (i.e. images that are nearby in the
+// sorted list) and merges the matching images directly into a shared
+// disjoint set (see fii_union_find.h).
+const uint32_t FII_CANDIDATE_RUN_TILE = 64;
+
+// copy UNIT bytes (e.g. all channels of a pixel) from each location of the
+// sampling plan, UNIT and the number of locations (NSAMPLE) are known at
+// compile time for the common images (gray, RGB, RGBA) and the default grid
+template<int UNIT, int NSAMPLE>
+void fii_gather_sample_kernel(const unsigned char *img_data,
+                              const uint32_t unit,
+                              const uint64_t *sample_offset,
+                              const uint32_t sample_count,
+                              uint8_t *feature) {
+  const uint32_t nu = (UNIT == 0) ? unit : UNIT;
+  const uint32_t ns = (NSAMPLE == 0) ? sample_count : NSAMPLE;
+  for(uint32_t si=0; si<ns; ++si) {
+    const unsigned char *sample = img_data + sample_offset[si];
+    for(uint32_t ui=0; ui<nu; ++ui) {
+      feature[ui] = sample[ui];
+    }
+    feature += nu;
+  }
+}
+
+template<int UNIT>
+void fii_gather_sparse_pixels(const unsigned char *img_data,
+                              const fii_feature_layout &layout,
+                              uint8_t *feature) {
+  uint32_t sample_count = layout.sample_offset.size();
+  if(sample_count == FII_SAMPLE_GRID_DEFAULT_COUNT) {
+    fii_gather_sample_kernel<UNIT, FII_SAMPLE_GRID_DEFAULT_COUNT>(img_data, layout.sample_unit,
+                                                                  layout.sample_offset.data(),
+                                                                  sample_count, feature);
+  } else {
+    fii_gather_sample_kernel<UNIT, 0>(img_data, layout.sample_unit,
+                                      layout.sample_offset.data(),
+                                      sample_count, feature);
+  }
+}
+
+// signatures of the tiers used to verify candidate identical images
+void fii_compute_check_tier_signature(const fii_check_tier &tier,
+                                      const unsigned char *img_data,
+                                      const int width,
+                                      const int height,
+                                      const int nchannel,
+                                      uint8_t *signature) {
+  uint64_t row_size = ((uint64_t) width) * nchannel;
+  if(tier.name == "grid") {
+    std::vector<uint8_t> grid;
+    grid.reserve(FII_CHECK_TIER_GRID_SIZE * FII_CHECK_TIER_GRID_SIZE * nchannel);
+    for(uint32_t gy=0; gy<FII_CHECK_TIER_GRID_SIZE; ++gy) {
+      uint64_t y = (((uint64_t) gy) * height) / FII_CHECK_TIER_GRID_SIZE;
+      for(uint32_t gx=0; gx<FII_CHECK_TIER_GRID_SIZE; ++gx) {
+        uint64_t x = (((uint64_t) gx) * width) / FII_CHECK_TIER_GRID_SIZE;
+        const unsigned char *pixel = img_data + y * row_size + x * nchannel;
+        grid.insert(grid.end(), pixel, pixel + nchannel);
+      }
+    }
+    uint64_t grid_hash = fii_hash64(grid.data(), grid.size());
+    std::memcpy(signature, &grid_hash, tier.size);
+  } else if(tier.name == "rowhash") {
+    uint32_t row_count = std::min((uint32_t) height, FII_CHECK_TIER_ROW_COUNT);
+    std::vector<uint64_t> row_hash(row_count);
+    for(uint32_t ri=0; ri<row_count; ++ri) {
+      uint64_t y = (((uint64_t) ri) * height) / row_count;
+      row_hash[ri] = fii_hash64(img_data + y * row_size, row_size);
+    }
+    uint64_t rowhash = fii_hash64(row_hash.data(), row_hash.size() * sizeof(uint64_t));
+    std::memcpy(signature, &rowhash, tier.size);
+  } else if(tier.name == "hash") {
+    uint64_t content_hash[2];
+    fii_hash128(img_data, row_size * height, 0, content_hash);
+    std::memcpy(signature, content_hash, tier.size);
+  }
+}
+
+// average pixel value (of each channel) in a grid of blocks quantised to a
+// few levels such that small changes in pixel values rarely change it
+void fii_compute_coarse_signature(const unsigned char *img_data,
+                                  const int width,
+                                  const int height,
+                                  const int nchannel,
+                                  uint8_t *signature) {
+  std::vector<uint64_t> block_sum(FII_COARSE_GRID_SIZE * FII_COARSE_GRID_SIZE * nchannel, 0);
+  std::vector<uint64_t> block_count(FII_COARSE_GRID_SIZE * FII_COARSE_GRID_SIZE, 0);
+  for(int y=0; y<height; ++y) {
+    uint64_t by = (((uint64_t) y) * FII_COARSE_GRID_SIZE) / height;
+    const unsigned char *row = img_data + ((uint64_t) y) * width * nchannel;
+    for(int x=0; x<width; ++x) {
+      uint64_t block = by * FII_COARSE_GRID_SIZE + (((uint64_t) x) * FII_COARSE_GRID_SIZE) / width;
+      for(int c=0; c<nchannel; ++c) {
+        block_sum[block * nchannel + c] += row[x * nchannel + c];
+      }
+      block_count[block] += 1;
+    }
+  }
+  for(std::size_t i=0; i<block_sum.size(); ++i) {
+    uint64_t count = std::max(block_count[i / nchannel], (uint64_t) 1);
+    signature[i] = (block_sum[i] * FII_COARSE_LEVEL_COUNT) / (count * 256);
+  }
+}
+
+// offset of pixel (x, y) of a transformed image in the source image (width x
+// height), transform t flips x (bit 0), flips y (bit 1) and transposes (bit 2)
+uint64_t fii_dihedral_src_offset(const int t,
+                                 const uint64_t x,
+                                 const uint64_t y,
+                                 const uint64_t width,
+                                 const uint64_t height) {
+  uint64_t sx = (t & 4) ? y : x;
+  uint64_t sy = (t & 4) ? x : y;
+  if(t & 1) {
+    sx = width - 1 - sx;
+  }
+  if(t & 2) {
+    sy = height - 1 - sy;
+  }
+  return sy * width + sx;
+}
+
+// canonical image of an image and its flipped or rotated copies, width and
+// height are updated to the dimension of the canonical image
+void fii_canonical_dihedral_img(const unsigned char *img_data,
+                                int &width,
+                                int &height,
+                                const int nchannel,
+                                std::vector<uint8_t> &canonical) {
+  uint64_t w = width;
+  uint64_t h = height;
+  std::vector<int> transforms;
+  for(int t=0; t<8; ++t) {
+    bool is_transposed = (t & 4) != 0;
+    if((w > h && is_transposed) || (w < h && !is_transposed)) {
+      continue; // canonical image is in landscape orientation
+    }
+    transforms.push_back(t);
+  }
+  uint64_t out_w = std::max(w, h);
+  uint64_t out_h = std::min(w, h);
+
+  // transforms are compared lazily: most differ in the first few values
+  int best = transforms[0];
+  for(std::size_t ti=1; ti<transforms.size(); ++ti) {
+    int t = transforms[ti];
+    int cmp = 0;
+    for(uint64_t y=0; y<out_h && cmp==0; ++y) {
+      for(uint64_t x=0; x<out_w && cmp==0; ++x) {
+        const unsigned char *p = img_data + fii_dihedral_src_offset(t, x, y, w, h) * nchannel;
+        const unsigned char *q = img_data + fii_dihedral_src_offset(best, x, y, w, h) * nchannel;
+        cmp = std::memcmp(p, q, nchannel);
+      }
+    }
+    if(cmp < 0) {
+      best = t;
+    }
+  }
+
+  canonical.resize(out_w * out_h * nchannel);
+  uint8_t *out = canonical.data();
+  for(uint64_t y=0; y<out_h; ++y) {
+    for(uint64_t x=0; x<out_w; ++x) {
+      std::memcpy(out, img_data + fii_dihedral_src_offset(best, x, y, w, h) * nchannel, nchannel);
+      out += nchannel;
+    }
+  }
+  width = out_w;
+  height = out_h;
+}
+
+// hash of the single channel form of grayscale images, the first byte of the
+// signature is 0 for images that are not grayscale
+void fii_compute_gray_signature(const unsigned char *img_data,
+                                const int width,
+                                const int height,
+                                const int nchannel,
+                                uint8_t *signature) {
+  uint64_t npixel = ((uint64_t) width) * height;
+  uint64_t hash[2];
+  signature[0] = 0;
+  if(nchannel == 1) {
+    fii_hash128(img_data, npixel, 0, hash);
+  } else {
+    // most colour images are rejected by their first few pixels
+    for(uint64_t i=0; i<npixel; ++i) {
+      const unsigned char *pixel = img_data + i * nchannel;
+      if(pixel[0] != pixel[1] || pixel[0] != pixel[2]) {
+        return;
+      }
+    }
+    std::vector<uint8_t> gray(npixel);
+    for(uint64_t i=0; i<npixel; ++i) {
+      gray[i] = img_data[i * nchannel];
+    }
+    fii_hash128(gray.data(), npixel, 0, hash);
+  }
+  signature[0] = 1;
+  std::memcpy(signature + 1, hash, 16);
+}
+
+// mean of the pixel values (of all channels) in each cell of a size x size
+// thumbnail, width and height must not be smaller than size
+void fii_compute_thumbnail(const unsigned char *img_data,
+                           const int width,
+                           const int height,
+                           const int nchannel,
+                           const uint32_t size,
+                           uint8_t *thumbnail) {
+  std::vector<uint64_t> sum(size * size, 0);
+  std::vector<uint64_t> count(size * size, 0);
+  std::vector<uint32_t> cell_x(width);
+  for(int x=0; x<width; ++x) {
+    cell_x[x] = (((uint64_t) x) * size) / width;
+  }
+  for(int y=0; y<height; ++y) {
+    uint32_t cell_y = (((uint64_t) y) * size) / height;
+    const unsigned char *row = img_data + ((uint64_t) y) * width * nchannel;
+    for(int x=0; x<width; ++x) {
+      uint32_t cell = cell_y * size + cell_x[x];
+      for(int c=0; c<nchannel; ++c) {
+        sum[cell] += row[x * nchannel + c];
+      }
+      count[cell] += nchannel;
+    }
+  }
+  for(uint32_t i=0; i<(size * size); ++i) {
+    thumbnail[i] = (sum[i] + count[i] / 2) / count[i];
+  }
+}
+
+// perceptual hash of an image (see FII_PHASH_THUMBNAIL_SIZE)
+uint64_t fii_compute_phash(const unsigned char *img_data,
+                           const int width,
+                           const int height,
+                           const int nchannel) {
+  // cosine basis of the lowest FII_PHASH_SIZE frequencies
+  double dct_basis[FII_PHASH_SIZE * FII_PHASH_THUMBNAIL_SIZE];
+  for(uint32_t u=0; u<FII_PHASH_SIZE; ++u) {
+    for(uint32_t x=0; x<FII_PHASH_THUMBNAIL_SIZE; ++x) {
+      dct_basis[u * FII_PHASH_THUMBNAIL_SIZE + x] = std::cos(((2 * x + 1) * u * M_PI) / (2 * FII_PHASH_THUMBNAIL_SIZE));
+    }
+  }
+
+  uint8_t thumbnail[FII_PHASH_THUMBNAIL_SIZE * FII_PHASH_THUMBNAIL_SIZE];
+  fii_compute_thumbnail(img_data, width, height, nchannel, FII_PHASH_THUMBNAIL_SIZE, thumbnail);
+
+  // separable DCT of rows followed by columns (only the lowest frequencies)
+  double row_dct[FII_PHASH_THUMBNAIL_SIZE][FII_PHASH_SIZE];
+  for(uint32_t y=0; y<FII_PHASH_THUMBNAIL_SIZE; ++y) {
+    for(uint32_t u=0; u<FII_PHASH_SIZE; ++u) {
+      double sum = 0.0;
+      for(uint32_t x=0; x<FII_PHASH_THUMBNAIL_SIZE; ++x) {
+        sum += dct_basis[u * FII_PHASH_THUMBNAIL_SIZE + x] * thumbnail[y * FII_PHASH_THUMBNAIL_SIZE + x];
+      }
+      row_dct[y][u] = sum;
+    }
+  }
+  std::vector<double> dct(FII_PHASH_SIZE * FII_PHASH_SIZE);
+  for(uint32_t v=0; v<FII_PHASH_SIZE; ++v) {
+    for(uint32_t u=0; u<FII_PHASH_SIZE; ++u) {
+      double sum = 0.0;
+      for(uint32_t y=0; y<FII_PHASH_THUMBNAIL_SIZE; ++y) {
+        sum += dct_basis[v * FII_PHASH_THUMBNAIL_SIZE + y] * row_dct[y][u];
+      }
+      dct[v * FII_PHASH_SIZE + u] = sum;
+    }
+  }
+  std::vector<double> sorted_dct(dct);
+  std::nth_element(sorted_dct.begin(), sorted_dct.begin() + dct.size() / 2, sorted_dct.end());
+  double median = sorted_dct[dct.size() / 2];
+  uint64_t hash = 0;
+  for(uint32_t i=0; i<dct.size(); ++i) {
+    if(dct[i] > median) {
+      hash |= ((uint64_t) 1) << i;
+    }
+  }
+  return hash;
+}
+
+void fii_add_img_signatures(const fii_feature_layout &layout,
+                            const uint8_t *feature,
+                            const uint32_t findex,
+                            fii_img_signatures &signatures) {
+  if(layout.gray_offset && feature[layout.gray_offset]) {
+    fii_gray_signature signature;
+    signature.findex = findex;
+    std::memcpy(signature.hash, feature + layout.gray_offset + 1, 16);
+    signatures.gray.push_back(signature);
+  }
+  if(layout.thumbnail_offset) {
+    fii_thumbnail thumbnail;
+    thumbnail.findex = findex;
+    thumbnail.width = layout.width;
+    thumbnail.height = layout.height;
+    thumbnail.nchannel = layout.nchannel;
+    std::memcpy(thumbnail.value, feature + layout.thumbnail_offset, FII_THUMBNAIL_VALUE_COUNT);
+    signatures.thumbnail.push_back(thumbnail);
+  }
+  if(layout.phash_offset) {
+    fii_phash phash;
+    phash.findex = findex;
+    std::memcpy(&phash.hash, feature + layout.phash_offset, sizeof(uint64_t));
+    signatures.phash.push_back(phash);
+  }
+  if(layout.crop_offset && feature[layout.crop_offset]) {
+    fii_crop_img crop;
+    std::memcpy(&crop, feature + layout.crop_offset + 1, sizeof(fii_crop_img));
+    crop.findex = findex;
+    signatures.crop.push_back(crop);
+  }
+}
+
+// byte identical copies (that are not decoded) of an image are crops of the
+// same images as the image
+void fii_add_byte_copy_signatures(const std::unordered_map<uint32_t, std::vector<uint32_t> > &byte_copies,
+                                  fii_img_signatures &signatures) {
+  std::size_t crop_count = signatures.crop.size();
+  for(std::size_t i=0; i<crop_count; ++i) {
+    std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator it = byte_copies.find(signatures.crop[i].findex);
+    if(it == byte_copies.end()) {
+      continue;
+    }
+    for(std::size_t ci=0; ci<it->second.size(); ++ci) {
+      fii_crop_img crop = signatures.crop[i];
+      crop.findex = it->second[ci];
+      signatures.crop.push_back(crop);
+    }
+  }
+}
 
-void fii_compute_img_feature(const std::string filename,
+// Returns false (and leaves the features unchanged) if the image cannot be
+// decoded or its data differs from its header. If decoded_pixels is not NULL,
+// it contains the pixel values (of canonical image if layout.is_dihedral) of
+// a well formed image.
+bool fii_compute_img_feature(const std::string filename,
                              const uint64_t feature_start_index,
-                             const uint64_t feature_count,
-                             std::vector<uint8_t> &features,
-                             const bool check_all_pixels=false) {
-  // feature_end_index = feature_start_index + feature_count
+                             const fii_feature_layout &layout,
+                             fii_feature_vector &features,
+                             std::vector<uint8_t> *decoded_pixels=NULL) {
+  // feature_end_index = feature_start_index + layout.img_feature_count
   // fill in features[feature_start_index : feature_end_index]
   int width, height, nchannel;
   // @todo: we can improve speed here by only loading the
@@ -51,34 +871,884 @@ void fii_compute_img_feature(const std::string filename,
   unsigned char *img_data = stbi_load(filename.c_str(), &width, &height, &nchannel, 0);
   if(!img_data) {
     // malformed image, discard
-    return;
+    return false;
+  }
+
+  const unsigned char *pixels = img_data;
+  std::vector<uint8_t> canonical_pixels;
+  if(layout.is_dihedral) {
+    fii_canonical_dihedral_img(img_data, width, height, nchannel, canonical_pixels);
+    pixels = canonical_pixels.data();
+  }
+
+  if(((uint32_t) width) != layout.width ||
+     ((uint32_t) height) != layout.height ||
+     ((uint32_t) nchannel) != layout.nchannel) {
+    // image data differs from image header, discard
+    stbi_image_free(img_data);
+    return false;
+  }
+
+  uint8_t *feature = features.data() + feature_start_index;
+  switch(layout.sample_unit) {
+  case 1:
+    fii_gather_sparse_pixels<1>(pixels, layout, feature);
+    break;
+  case 3:
+    fii_gather_sparse_pixels<3>(pixels, layout, feature);
+    break;
+  case 4:
+    fii_gather_sparse_pixels<4>(pixels, layout, feature);
+    break;
+  default:
+    fii_gather_sparse_pixels<0>(pixels, layout, feature);
   }
 
-  if(check_all_pixels) {
-    uint32_t npixel = width * height * nchannel;
-    for(uint32_t feature_index=0; feature_index<npixel; ++feature_index) {
-      features.at(feature_start_index + feature_index) = img_data[feature_index];
+  if(fii_is_tolerant(layout.tolerance)) {
+    fii_compute_coarse_signature(pixels, width, height, nchannel,
+                                 feature + layout.key_offset);
+  }
+  for(std::size_t ti=0; ti<layout.tiers.size(); ++ti) {
+    fii_compute_check_tier_signature(layout.tiers[ti],
+                                     pixels, width, height, nchannel,
+                                     feature + layout.tiers[ti].offset);
+  }
+  if(layout.gray_offset) {
+    fii_compute_gray_signature(pixels, width, height, nchannel,
+                               feature + layout.gray_offset);
+  }
+  if(layout.thumbnail_offset) {
+    fii_compute_thumbnail(pixels, width, height, nchannel, FII_THUMBNAIL_SIZE,
+                          feature + layout.thumbnail_offset);
+  }
+  if(layout.phash_offset) {
+    uint64_t phash = fii_compute_phash(pixels, width, height, nchannel);
+    std::memcpy(feature + layout.phash_offset, &phash, sizeof(uint64_t));
+  }
+  if(layout.crop_offset) {
+    // crops are found in the stored (not canonical) orientation of images
+    fii_crop_img crop = fii_crop_img();
+    feature[layout.crop_offset] = fii_crop_compute_anchor(img_data, width, height, nchannel, crop);
+    std::memcpy(feature + layout.crop_offset + 1, &crop, sizeof(fii_crop_img));
+  }
+  if(decoded_pixels) {
+    if(layout.is_dihedral) {
+      decoded_pixels->swap(canonical_pixels);
+    } else {
+      uint64_t npixel = ((uint64_t) width) * height * nchannel;
+      decoded_pixels->assign(img_data, img_data + npixel);
     }
+  }
+  stbi_image_free(img_data);
+  return true;
+}
+
+// load pixel values (of canonical image if is_dihedral is true) of an image
+// (empty for malformed images)
+void fii_load_img_pixels(const std::string filename,
+                         std::vector<uint8_t> &pixels,
+                         const bool is_dihedral=false) {
+  pixels.clear();
+  int width, height, nchannel;
+  unsigned char *img_data = stbi_load(filename.c_str(), &width, &height, &nchannel, 0);
+  if(!img_data) {
+    return;
+  }
+  if(is_dihedral) {
+    fii_canonical_dihedral_img(img_data, width, height, nchannel, pixels);
   } else {
-    std::vector<uint32_t> xp, yp;
-    xp.reserve(FII_IMG_FEATURE_LOC_SCALE.size());
-    yp.reserve(FII_IMG_FEATURE_LOC_SCALE.size());
-    for(uint32_t i=0; i<FII_IMG_FEATURE_LOC_SCALE.size(); ++i) {
-      xp.push_back( uint32_t(width  * FII_IMG_FEATURE_LOC_SCALE.at(i)) );
-      yp.push_back( uint32_t(height * FII_IMG_FEATURE_LOC_SCALE.at(i)) );
+    uint64_t npixel = ((uint64_t) width) * height * nchannel;
+    pixels.assign(img_data, img_data + npixel);
+  }
+  stbi_image_free(img_data);
+}
+
+// append the path of (at most) sample_count images randomly chosen from a list
+void fii_add_adaptive_sampling_img(const std::vector<std::string> &filename_list,
+                                   const std::vector<uint32_t> &filename_index_list,
+                                   const std::string filename_prefix,
+                                   const uint32_t sample_count,
+                                   std::vector<std::string> &sample_path_list) {
+  std::vector<uint32_t> index_list(filename_index_list);
+  std::mt19937 rng(FII_ADAPTIVE_SAMPLING_SEED);
+  uint32_t count = std::min(sample_count, (uint32_t) index_list.size());
+  for(uint32_t i=0; i<count; ++i) {
+    uint32_t j = i + rng() % (index_list.size() - i);
+    std::swap(index_list[i], index_list[j]);
+    sample_path_list.push_back(filename_prefix + filename_list.at(index_list[i]));
+  }
+}
+
+// Choose the location of sparse feature values as the grid locations (and
+// colour channels) with the highest variance of pixel values in the sample
+// images. The fixed grid is used if the sample images cannot be decoded.
+void fii_init_adaptive_sampling(const std::vector<std::string> &sample_path_list,
+                                const std::vector<uint32_t> &img_dim,
+                                fii_feature_layout &layout) {
+  uint64_t width = img_dim[0];
+  uint64_t height = img_dim[1];
+  uint64_t nchannel = img_dim[2];
+
+  // candidate locations: centre of each cell of the grid (without repetition)
+  std::vector<uint64_t> candidate_offset;
+  for(uint32_t gy=0; gy<FII_ADAPTIVE_SAMPLING_GRID_SIZE; ++gy) {
+    uint64_t y = ((2 * gy + 1) * height) / (2 * FII_ADAPTIVE_SAMPLING_GRID_SIZE);
+    for(uint32_t gx=0; gx<FII_ADAPTIVE_SAMPLING_GRID_SIZE; ++gx) {
+      uint64_t x = ((2 * gx + 1) * width) / (2 * FII_ADAPTIVE_SAMPLING_GRID_SIZE);
+      for(uint64_t c=0; c<nchannel; ++c) {
+        candidate_offset.push_back((y * width + x) * nchannel + c);
+      }
+    }
+  }
+  std::sort(candidate_offset.begin(), candidate_offset.end());
+  candidate_offset.erase(std::unique(candidate_offset.begin(), candidate_offset.end()),
+                         candidate_offset.end());
+  if(candidate_offset.size() < layout.sparse_feature_count) {
+    return; // too few pixels in image
+  }
+
+  std::vector<std::vector<uint8_t> > sample_values(sample_path_list.size());
+#pragma omp parallel for schedule(dynamic)
+  for(std::size_t i=0; i<sample_path_list.size(); ++i) {
+    std::vector<uint8_t> pixels;
+    fii_load_img_pixels(sample_path_list[i], pixels, layout.is_dihedral);
+    if(pixels.size() != width * height * nchannel) {
+      continue; // malformed image
     }
+    for(std::size_t ci=0; ci<candidate_offset.size(); ++ci) {
+      sample_values[i].push_back(pixels[ candidate_offset[ci] ]);
+    }
+  }
+
+  // n^2 times the variance of pixel values at each candidate location
+  std::vector<int64_t> sum(candidate_offset.size(), 0);
+  std::vector<int64_t> sum_sq(candidate_offset.size(), 0);
+  int64_t n = 0;
+  for(std::size_t i=0; i<sample_values.size(); ++i) {
+    if(sample_values[i].size() == 0) {
+      continue;
+    }
+    n += 1;
+    for(std::size_t ci=0; ci<candidate_offset.size(); ++ci) {
+      int64_t value = sample_values[i][ci];
+      sum[ci] += value;
+      sum_sq[ci] += value * value;
+    }
+  }
+  if(n < 2) {
+    return;
+  }
+  std::vector<int64_t> variance(candidate_offset.size());
+  std::vector<uint32_t> candidate_order(candidate_offset.size());
+  for(std::size_t ci=0; ci<candidate_offset.size(); ++ci) {
+    variance[ci] = n * sum_sq[ci] - sum[ci] * sum[ci];
+    candidate_order[ci] = ci;
+  }
+  std::stable_sort(candidate_order.begin(), candidate_order.end(),
+                   [&variance](const uint32_t a, const uint32_t b) {
+                     return variance[a] > variance[b];
+                   });
+
+  // sorted locations access the decoded image sequentially
+  layout.sample_unit = 1;
+  layout.sample_offset.clear();
+  for(uint32_t i=0; i<layout.sparse_feature_count; ++i) {
+    layout.sample_offset.push_back(candidate_offset[ candidate_order[i] ]);
+  }
+  std::sort(layout.sample_offset.begin(), layout.sample_offset.end());
+}
+
+// Split groups of images (found using hash of all pixel values) such that all
+// members of a group have identical pixel values. Each member is compared
+// with the representative of distinct images seen so far in the group that
+// have the same hash of pixel values. Therefore, a group with k members is
+// verified using O(k) comparisons even if it contains many distinct images.
+// Image index greater than filename_list1.size() refers to filename_list2
+// and, in this case, a group must contain images from both the lists. Images
+// whose pixels are in the cache (if any) are not decoded again.
+void fii_confirm_identical_img(const std::vector<std::string> &filename_list1,
+                               const std::string filename_prefix1,
+                               const std::vector<std::string> &filename_list2,
+                               const std::string filename_prefix2,
+                               std::vector<std::set<uint32_t> > &image_groups,
+                               const fii_tolerance &tolerance=fii_tolerance(),
+                               const bool is_dihedral=false,
+                               fii_pixel_cache *cache=NULL) {
+  bool is_tolerant = fii_is_tolerant(tolerance);
+  uint32_t findex_offset = filename_list1.size();
+  std::vector<std::vector<std::set<uint32_t> > > confirmed_groups(image_groups.size());
+
+  // largest groups are verified first so that a large group assigned at the
+  // end does not keep a single thread busy after all others have finished
+  std::vector<uint32_t> group_order(image_groups.size());
+  for(uint32_t group_id=0; group_id<image_groups.size(); ++group_id) {
+    group_order[group_id] = group_id;
+  }
+  std::stable_sort(group_order.begin(), group_order.end(),
+                   [&image_groups](const uint32_t a, const uint32_t b) {
+                     return image_groups[a].size() > image_groups[b].size();
+                   });
 
-    uint64_t feature_index = 0;
-    for(uint32_t xi=0; xi<xp.size(); ++xi) {
-      for(uint32_t yi=0; yi<yp.size(); ++yi) {
-        features.at(feature_start_index + feature_index) = img_data[ yp[yi]*width*nchannel + xp[xi]*nchannel ];
-        feature_index++;
+  // each group is verified independently and therefore, memory used by a
+  // thread is bounded by the pixels of distinct images in the largest group
+#pragma omp parallel for schedule(dynamic)
+  for(std::size_t order_id=0; order_id<group_order.size(); ++order_id) {
+    uint32_t group_id = group_order[order_id];
+    std::vector<std::vector<uint8_t> > rep_pixels;
+    std::vector<std::set<uint32_t> > subgroups;
+    std::unordered_map<uint64_t, std::vector<uint32_t> > subgroups_of_hash;
+    std::set<uint32_t>::const_iterator si;
+    for(si=image_groups[group_id].begin(); si!=image_groups[group_id].end(); ++si) {
+      uint32_t findex = *si;
+      std::string file_path;
+      if(findex >= findex_offset) {
+        file_path = filename_prefix2 + filename_list2.at(findex - findex_offset);
+      } else {
+        file_path = filename_prefix1 + filename_list1.at(findex);
+      }
+      std::vector<uint8_t> pixels;
+      uint32_t comparison_count = fii_pixel_cache_comparison_count(image_groups[group_id], findex);
+      if(!cache || !fii_pixel_cache_take(*cache, findex, pixels, comparison_count)) {
+        fii_load_img_pixels(file_path, pixels, is_dihedral);
       }
+      if(pixels.size() == 0) {
+        continue; // cannot be decoded, all undecodable images are not identical
+      }
+
+      // near identical images are compared with all representatives
+      uint64_t pixels_hash = is_tolerant ? 0 : fii_hash64(pixels.data(), pixels.size());
+      uint64_t max_diff_count = fii_max_diff_count(tolerance, pixels.size());
+      std::vector<uint32_t> &candidate_subgroups = subgroups_of_hash[pixels_hash];
+      bool is_new_subgroup = true;
+      for(std::size_t i=0; i<candidate_subgroups.size(); ++i) {
+        uint32_t ri = candidate_subgroups[i];
+        bool is_match;
+        if(is_tolerant) {
+          is_match = pixels.size() && rep_pixels[ri].size() == pixels.size() &&
+            fii_count_diff(rep_pixels[ri].data(), pixels.data(), pixels.size(),
+                           tolerance.max_pixel_diff, max_diff_count) <= max_diff_count;
+        } else {
+          is_match = rep_pixels[ri] == pixels;
+        }
+        if(is_match) {
+          subgroups[ri].insert(findex);
+          is_new_subgroup = false;
+          break;
+        }
+      }
+      if(is_new_subgroup) {
+        candidate_subgroups.push_back(subgroups.size());
+        rep_pixels.push_back(std::vector<uint8_t>());
+        rep_pixels.back().swap(pixels);
+        subgroups.push_back(std::set<uint32_t>());
+        subgroups.back().insert(findex);
+      }
+    }
+
+    for(std::size_t ri=0; ri<subgroups.size(); ++ri) {
+      const std::set<uint32_t> &subgroup = subgroups[ri];
+      if(subgroup.size() < 2) {
+        continue;
+      }
+      if(filename_list2.size()) {
+        // a group must contain images from both folders
+        bool has_img1 = (*subgroup.begin()) < findex_offset;
+        bool has_img2 = (*subgroup.rbegin()) >= findex_offset;
+        if(!has_img1 || !has_img2) {
+          continue;
+        }
+      }
+      confirmed_groups[group_id].push_back(subgroup);
     }
   }
-  stbi_image_free(img_data);
+
+  image_groups.clear();
+  for(std::size_t group_id=0; group_id<confirmed_groups.size(); ++group_id) {
+    image_groups.insert(image_groups.end(),
+                        confirmed_groups[group_id].begin(),
+                        confirmed_groups[group_id].end());
+  }
 }
 
+uint64_t fii_candidate_img_count(const std::vector<std::set<uint32_t> > &image_groups) {
+  uint64_t count = 0;
+  for(std::size_t group_id=0; group_id<image_groups.size(); ++group_id) {
+    count += image_groups[group_id].size();
+  }
+  return count;
+}
+
+// load all bytes of a file using a single sequential read
+bool fii_load_file_bytes(const std::string filename,
+                         std::vector<char> &bytes) {
+  std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+  if(!f) {
+    return false;
+  }
+  std::streamsize size = f.tellg();
+  f.seekg(0, std::ios::beg);
+  bytes.resize(size);
+  return (bool) f.read(bytes.data(), size);
+}
+
+// Files that are byte-for-byte copies of each other are identical images and
+// therefore, only one representative of each set of byte identical files needs
+// to be decoded. Paths that refer to the same file (i.e. same device and inode
+// number, e.g. hardlinks) are copies without reading the file. Other files are
+// grouped by their size and only the files that have the same size as another
+// file are read to compute the 128 bit hash of their bytes. If compare_bytes
+// is true, the bytes of each copy are also compared with the representative to
+// avoid any false positive.
+//
+// rep_index_list contains the representatives (and all files that are not
+// copies) from filename_index_list. byte_copies maps the findex (offset by
+// findex_offset) of a representative to the findex of its copies. Returns the
+// number of copies that are links to the same file.
+uint32_t fii_find_byte_identical_files(const std::vector<std::string> &filename_list,
+                                       const std::vector<uint32_t> &filename_index_list,
+                                       const std::string filename_prefix,
+                                       const uint32_t findex_offset,
+                                       const bool compare_bytes,
+                                       std::vector<uint32_t> &rep_index_list,
+                                       std::unordered_map<uint32_t, std::vector<uint32_t> > &byte_copies) {
+  uint32_t file_count = filename_index_list.size();
+  std::vector<int64_t> file_size(file_count, -1);
+  std::vector<fii::fs_inode> file_inode(file_count);
+#pragma omp parallel for
+  for(uint32_t i=0; i<file_count; ++i) {
+    struct stat file_stat;
+    std::string file_path = filename_prefix + filename_list.at(filename_index_list[i]);
+    if(stat(file_path.c_str(), &file_stat) == 0) {
+      file_size[i] = file_stat.st_size;
+      file_inode[i] = fii::fs_inode(file_stat.st_dev, file_stat.st_ino);
+    }
+  }
+
+  // the first path of a file is the representative of all its links
+  std::vector<uint32_t> rep(file_count);
+  std::map<fii::fs_inode, uint32_t> rep_of_inode;
+  uint32_t link_count = 0;
+  for(uint32_t i=0; i<file_count; ++i) {
+    rep[i] = i;
+    if(file_size[i] < 0) {
+      continue;
+    }
+    std::map<fii::fs_inode, uint32_t>::const_iterator ri = rep_of_inode.find(file_inode[i]);
+    if(ri == rep_of_inode.end()) {
+      rep_of_inode[ file_inode[i] ] = i;
+    } else {
+      rep[i] = ri->second;
+      link_count += 1;
+    }
+  }
+
+  std::unordered_map<int64_t, uint32_t> files_of_size;
+  for(uint32_t i=0; i<file_count; ++i) {
+    if(rep[i] == i) {
+      files_of_size[ file_size[i] ] += 1;
+    }
+  }
+  std::vector<uint32_t> hash_index;
+  for(uint32_t i=0; i<file_count; ++i) {
+    if(rep[i] == i && file_size[i] > 0 && files_of_size[ file_size[i] ] > 1) {
+      hash_index.push_back(i);
+    }
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t> > file_hash(file_count, std::make_pair(0, 0));
+  std::vector<uint8_t> has_file_hash(file_count, 0);
+#pragma omp parallel for schedule(dynamic)
+  for(uint32_t hi=0; hi<hash_index.size(); ++hi) {
+    uint32_t i = hash_index[hi];
+    std::string file_path = filename_prefix + filename_list.at(filename_index_list[i]);
+    std::vector<char> bytes;
+    if(fii_load_file_bytes(file_path, bytes)) {
+      uint64_t hash[2];
+      fii_hash128(bytes.data(), bytes.size(), 0, hash);
+      file_hash[i] = std::make_pair(hash[0], hash[1]);
+      has_file_hash[i] = 1;
+    }
+  }
+
+  // the first file with a given size and hash is the representative
+  std::map<std::pair<int64_t, std::pair<uint64_t, uint64_t> >, uint32_t> rep_of_file_key;
+  std::vector<uint32_t> byte_rep(file_count);
+  for(uint32_t i=0; i<file_count; ++i) {
+    byte_rep[i] = i;
+    if(!has_file_hash[i]) {
+      continue;
+    }
+    std::pair<int64_t, std::pair<uint64_t, uint64_t> > file_key(file_size[i], file_hash[i]);
+    if(rep_of_file_key.count(file_key)) {
+      byte_rep[i] = rep_of_file_key[file_key];
+    } else {
+      rep_of_file_key[file_key] = i;
+    }
+  }
+
+  if(compare_bytes) {
+#pragma omp parallel for schedule(dynamic)
+    for(uint32_t hi=0; hi<hash_index.size(); ++hi) {
+      uint32_t i = hash_index[hi];
+      if(byte_rep[i] == i) {
+        continue;
+      }
+      std::vector<char> bytes, rep_bytes;
+      std::string file_path = filename_prefix + filename_list.at(filename_index_list[i]);
+      std::string rep_file_path = filename_prefix + filename_list.at(filename_index_list[ byte_rep[i] ]);
+      if(!fii_load_file_bytes(file_path, bytes) ||
+         !fii_load_file_bytes(rep_file_path, rep_bytes) ||
+         bytes != rep_bytes) {
+        byte_rep[i] = i; // decoded as a separate image
+      }
+    }
+  }
+  for(uint32_t i=0; i<file_count; ++i) {
+    rep[i] = byte_rep[ rep[i] ];
+  }
+
+  rep_index_list.clear();
+  byte_copies.clear();
+  for(uint32_t i=0; i<file_count; ++i) {
+    if(rep[i] == i) {
+      rep_index_list.push_back(filename_index_list[i]);
+    } else {
+      byte_copies[ findex_offset + filename_index_list[ rep[i] ] ].push_back(findex_offset + filename_index_list[i]);
+    }
+  }
+  return link_count;
+}
+
+// add byte identical copies of each image to its group of identical images and,
+// if add_copy_groups is true, create a new group for the images that are only
+// identical to their byte identical copies
+void fii_add_byte_identical_files(const std::unordered_map<uint32_t, std::vector<uint32_t> > &byte_copies,
+                                  const bool add_copy_groups,
+                                  std::vector<std::set<uint32_t> > &image_groups) {
+  if(byte_copies.size() == 0) {
+    return;
+  }
+  std::set<uint32_t> grouped_reps;
+  for(std::size_t group_id=0; group_id<image_groups.size(); ++group_id) {
+    std::vector<uint32_t> members(image_groups[group_id].begin(), image_groups[group_id].end());
+    for(std::size_t mi=0; mi<members.size(); ++mi) {
+      std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator ci = byte_copies.find(members[mi]);
+      if(ci != byte_copies.end()) {
+        image_groups[group_id].insert(ci->second.begin(), ci->second.end());
+        grouped_reps.insert(members[mi]);
+      }
+    }
+  }
+  if(!add_copy_groups) {
+    return;
+  }
+  std::vector<uint32_t> copy_group_reps;
+  std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator ci;
+  for(ci=byte_copies.begin(); ci!=byte_copies.end(); ++ci) {
+    if(grouped_reps.count(ci->first) == 0) {
+      copy_group_reps.push_back(ci->first);
+    }
+  }
+  std::sort(copy_group_reps.begin(), copy_group_reps.end());
+  for(std::size_t i=0; i<copy_group_reps.size(); ++i) {
+    const std::vector<uint32_t> &copies = byte_copies.at(copy_group_reps[i]);
+    image_groups.push_back(std::set<uint32_t>(copies.begin(), copies.end()));
+    image_groups.back().insert(copy_group_reps[i]);
+  }
+}
+
+uint64_t fii_byte_identical_file_count(const std::unordered_map<uint32_t, std::vector<uint32_t> > &byte_copies) {
+  uint64_t count = 0;
+  std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator ci;
+  for(ci=byte_copies.begin(); ci!=byte_copies.end(); ++ci) {
+    count += ci->second.size();
+  }
+  return count;
+}
+
+void fii_show_file_copy_stats(const fii_match_stats &stats) {
+  if(stats.hardlink_count) {
+    std::cout << "Found " << stats.hardlink_count
+              << " hardlinks to image files (not decoded)." << std::endl;
+  }
+  if(stats.byte_identical_count) {
+    std::cout << "Found " << stats.byte_identical_count
+              << " byte identical copies of image files (not decoded)." << std::endl;
+  }
+}
+
+void fii_show_undecodable_files(const fii_match_stats &stats) {
+  if(stats.undecodable_file_list.size() == 0) {
+    return;
+  }
+  std::cout << "Discarded " << stats.undecodable_file_list.size()
+            << " images that could not be decoded:" << std::endl;
+  for(std::size_t i=0; i<stats.undecodable_file_list.size(); ++i) {
+    std::cout << "  " << stats.undecodable_file_list[i] << std::endl;
+  }
+}
+
+void fii_show_match_stats(const fii_match_stats &stats) {
+  std::cout << "Pass 1 (sparse pixels) found " << stats.pass1_candidate_count
+            << " candidate images, pass 2 (all pixels) rejected "
+            << stats.pass2_rejected_count << " of them." << std::endl;
+  for(std::size_t ti=0; ti<stats.tier_name.size(); ++ti) {
+    std::cout << "  " << std::setw(8) << std::left << stats.tier_name[ti] << std::right
+              << ": compared " << stats.tier_checked_count[ti] << " images, "
+              << "rejected " << stats.tier_rejected_count[ti] << " images, "
+              << "read " << std::setprecision(3)
+              << (((double) stats.tier_value_count[ti]) / 1e6)
+              << "M pixel values" << std::endl;
+  }
+  if(stats.pixel_cache_hit_count) {
+    std::cout << "Pass 2 reused the pixels of " << stats.pixel_cache_hit_count
+              << " images decoded in pass 1." << std::endl;
+  }
+}
+
+// Split each set of candidate images such that all the members of a set have
+// identical feature values in [offset, offset+size) of their feature row. Sets
+// with a single image are discarded. Images [0, img_count1) are from the first
+// list and, if img_count1 < img_count, each set must contain images from both
+// the lists.
+void fii_split_candidate_sets(const fii_feature_vector &features,
+                              const uint32_t img_feature_stride,
+                              const uint32_t offset,
+                              const uint32_t size,
+                              const uint32_t img_count,
+                              const uint32_t img_count1,
+                              std::vector<std::vector<uint32_t> > &sets,
+                              const uint32_t max_value_diff=0,
+                              const uint64_t max_diff_count=0) {
+  bool use_simd_kernel = (offset % FII_SIMD_ALIGNMENT) == 0 && (size % FII_SIMD_ALIGNMENT) == 0;
+  bool is_tolerant = max_value_diff || max_diff_count;
+  std::vector<std::vector<uint32_t> > split_sets;
+  for(std::size_t si=0; si<sets.size(); ++si) {
+    // compare each image only with the representative (i.e. first member) of
+    // distinct features seen so far in this set that have the same hash value
+    std::vector<std::vector<uint32_t> > subsets;
+    std::unordered_map<uint64_t, std::vector<uint32_t> > subsets_of_hash;
+    for(std::size_t mi=0; mi<sets[si].size(); ++mi) {
+      uint32_t mj = sets[si][mi];
+      const uint8_t *mj_feature = &features[((uint64_t) mj) * img_feature_stride + offset];
+      uint64_t mj_hash = is_tolerant ? 0 : fii_hash64(mj_feature, size);
+      std::vector<uint32_t> &candidate_subsets = subsets_of_hash[mj_hash];
+      bool is_new_subset = true;
+      for(std::size_t i=0; i<candidate_subsets.size(); ++i) {
+        uint32_t ci = candidate_subsets[i];
+        uint32_t qi = subsets[ci][0];
+        const uint8_t *qi_feature = &features[((uint64_t) qi) * img_feature_stride + offset];
+        bool is_equal;
+        if(is_tolerant) {
+          is_equal = fii_count_diff(qi_feature, mj_feature, size,
+                                    max_value_diff, max_diff_count) <= max_diff_count;
+        } else if(use_simd_kernel) {
+          is_equal = fii_row_equal(qi_feature, mj_feature, size);
+        } else {
+          is_equal = std::memcmp(qi_feature, mj_feature, size) == 0;
+        }
+        if(is_equal) {
+          subsets[ci].push_back(mj);
+          is_new_subset = false;
+          break;
+        }
+      }
+      if(is_new_subset) {
+        candidate_subsets.push_back(subsets.size());
+        subsets.push_back(std::vector<uint32_t>(1, mj));
+      }
+    }
+
+    for(std::size_t ci=0; ci<subsets.size(); ++ci) {
+      if(subsets[ci].size() < 2) {
+        continue;
+      }
+      if(img_count1 < img_count) {
+        bool has_img1 = false;
+        bool has_img2 = false;
+        for(std::size_t mi=0; mi<subsets[ci].size(); ++mi) {
+          if(subsets[ci][mi] < img_count1) {
+            has_img1 = true;
+          } else {
+            has_img2 = true;
+          }
+        }
+        if(!has_img1 || !has_img2) {
+          continue;
+        }
+      }
+      split_sets.push_back(std::vector<uint32_t>());
+      split_sets.back().swap(subsets[ci]);
+    }
+  }
+  sets.swap(split_sets);
+}
+
+uint64_t fii_candidate_sets_img_count(const std::vector<std::vector<uint32_t> > &sets) {
+  uint64_t count = 0;
+  for(std::size_t si=0; si<sets.size(); ++si) {
+    count += sets[si].size();
+  }
+  return count;
+}
+
+// Merge images with identical features into the same set of image_sets.
+// Images [0, img_count1) are from the first list and [img_count1, img_count)
+// from the second list. If img_count1 == img_count, identical images are
+// searched within a single list.
+void fii_group_identical_features(const fii_feature_vector &features,
+                                  const uint32_t img_count,
+                                  const uint32_t img_count1,
+                                  const fii_feature_layout &layout,
+                                  fii_union_find &image_sets,
+                                  std::vector<uint64_t> &tier_checked_count,
+                                  std::vector<uint64_t> &tier_rejected_count) {
+  // partition images using the hash of their sparse features (i.e. pass 1)
+  std::vector<uint64_t> feature_key;
+  std::vector<uint32_t> sorted_index;
+  fii_sort_by_feature_key(features, layout, feature_key, sorted_index);
+
+  // only runs containing more than one image (from both lists) are compared
+  std::vector<std::pair<uint32_t, uint32_t> > runs;
+  fii_find_candidate_runs(feature_key, sorted_index, runs);
+  std::vector<std::pair<uint32_t, uint32_t> > candidate_runs;
+  for(std::size_t i=0; i<runs.size(); ++i) {
+    uint32_t run_start = runs[i].first;
+    uint32_t run_end = runs[i].second;
+    if((run_end - run_start) < 2) {
+      continue;
+    }
+    // images with same key are sorted by their index
+    if(img_count1 < img_count &&
+       (sorted_index[run_start] >= img_count1 || sorted_index[run_end - 1] < img_count1)) {
+      continue;
+    }
+    candidate_runs.push_back(runs[i]);
+  }
+
+  // tier 0 is the sparse features, exact tier is handled by the caller
+  uint32_t tier_count = layout.tiers.size() + 1;
+  if(fii_has_exact_tier(layout)) {
+    tier_count = tier_count - 1;
+  }
+  tier_checked_count.assign(tier_count, 0);
+  tier_rejected_count.assign(tier_count, 0);
+  tier_checked_count[0] = img_count;
+  uint64_t sparse_max_diff_count = std::ceil(2.0 * layout.tolerance.max_diff_fraction * layout.sparse_feature_count);
+#pragma omp parallel for schedule(dynamic, FII_CANDIDATE_RUN_TILE)
+  for(uint32_t run_id=0; run_id<candidate_runs.size(); ++run_id) {
+    uint32_t run_start = candidate_runs[run_id].first;
+    uint32_t run_end   = candidate_runs[run_id].second;
+    std::vector<std::vector<uint32_t> > sets(1);
+    sets[0].assign(sorted_index.begin() + run_start, sorted_index.begin() + run_end);
+
+    // hash collision is possible, therefore sparse features are compared
+    fii_split_candidate_sets(features, layout.img_feature_stride,
+                             0, layout.sparse_feature_stride,
+                             img_count, img_count1, sets,
+                             layout.tolerance.max_pixel_diff, sparse_max_diff_count);
+    uint64_t survivor_count = fii_candidate_sets_img_count(sets);
+#pragma omp atomic
+    tier_rejected_count[0] += (run_end - run_start) - survivor_count;
+
+    for(uint32_t ti=1; ti<tier_count && sets.size(); ++ti) {
+      const fii_check_tier &tier = layout.tiers[ti - 1];
+      uint64_t checked_count = survivor_count;
+      fii_split_candidate_sets(features, layout.img_feature_stride,
+                               tier.offset, tier.size,
+                               img_count, img_count1, sets);
+      survivor_count = fii_candidate_sets_img_count(sets);
+#pragma omp atomic
+      tier_checked_count[ti] += checked_count;
+#pragma omp atomic
+      tier_rejected_count[ti] += checked_count - survivor_count;
+    }
+
+    for(std::size_t si=0; si<sets.size(); ++si) {
+      for(std::size_t mi=1; mi<sets[si].size(); ++mi) {
+        fii_union_find_merge(image_sets, sets[si][0], sets[si][mi]);
+      }
+    }
+  }
+  // images in runs that were not compared are rejected by the sparse features
+  uint64_t run_img_count = 0;
+  for(std::size_t i=0; i<candidate_runs.size(); ++i) {
+    run_img_count += candidate_runs[i].second - candidate_runs[i].first;
+  }
+  tier_rejected_count[0] += img_count - run_img_count;
+}
+
+// update statistics using the result of fii_group_identical_features()
+void fii_update_match_stats(const fii_feature_layout &layout,
+                            const std::vector<uint32_t> &img_dim,
+                            const uint64_t img_count,
+                            const std::vector<uint64_t> &tier_checked_count,
+                            const std::vector<uint64_t> &tier_rejected_count,
+                            const uint64_t exact_checked_count,
+                            const uint64_t exact_rejected_count,
+                            fii_match_stats *stats) {
+  if(!stats) {
+    return;
+  }
+  uint64_t npixel = ((uint64_t) img_dim[0]) * img_dim[1] * img_dim[2];
+  for(std::size_t ti=0; ti<tier_checked_count.size(); ++ti) {
+    std::string name = "sparse";
+    uint64_t value_count = layout.sparse_feature_count;
+    if(ti) {
+      name = layout.tiers[ti - 1].name;
+      if(name == "grid") {
+        value_count = std::min(npixel, (uint64_t) FII_CHECK_TIER_GRID_SIZE * FII_CHECK_TIER_GRID_SIZE * img_dim[2]);
+      } else if(name == "rowhash") {
+        value_count = std::min(npixel, ((uint64_t) FII_CHECK_TIER_ROW_COUNT) * img_dim[0] * img_dim[2]);
+      } else {
+        value_count = npixel;
+      }
+    }
+    uint32_t stats_ti = fii_match_stats_tier(*stats, name);
+    stats->tier_checked_count[stats_ti] += tier_checked_count[ti];
+    stats->tier_rejected_count[stats_ti] += tier_rejected_count[ti];
+    // signatures are computed for all images while decoding
+    stats->tier_value_count[stats_ti] += img_count * value_count;
+    if(ti) {
+      stats->pass2_rejected_count += tier_rejected_count[ti];
+    }
+  }
+  stats->pass1_candidate_count += tier_checked_count[0] - tier_rejected_count[0];
+
+  if(fii_has_exact_tier(layout)) {
+    std::string name = fii_is_tolerant(layout.tolerance) ? "near" : "exact";
+    uint32_t stats_ti = fii_match_stats_tier(*stats, name);
+    stats->tier_checked_count[stats_ti] += exact_checked_count;
+    stats->tier_rejected_count[stats_ti] += exact_rejected_count;
+    stats->tier_value_count[stats_ti] += exact_checked_count * npixel;
+    stats->pass2_rejected_count += exact_rejected_count;
+  }
+}
+
+// Images that cannot be decoded have no features and are excluded from
+// matching: their feature rows and index (in filename_index_list) are removed
+// and their findex (i.e. findex_offset + index) is appended to
+// undecodable_findex_list.
+void fii_remove_undecodable_img(const std::vector<uint8_t> &is_decoded,
+                                const fii_feature_layout &layout,
+                                const uint32_t findex_offset,
+                                std::vector<uint32_t> &filename_index_list,
+                                fii_feature_vector &features,
+                                std::vector<uint32_t> &undecodable_findex_list) {
+  uint32_t decoded_count = 0;
+  for(uint32_t i=0; i<filename_index_list.size(); ++i) {
+    if(!is_decoded[i]) {
+      undecodable_findex_list.push_back(findex_offset + filename_index_list[i]);
+      continue;
+    }
+    if(decoded_count != i) {
+      std::memcpy(&features[((uint64_t) decoded_count) * layout.img_feature_stride],
+                  &features[((uint64_t) i) * layout.img_feature_stride],
+                  layout.img_feature_stride);
+      filename_index_list[decoded_count] = filename_index_list[i];
+    }
+    decoded_count += 1;
+  }
+  filename_index_list.resize(decoded_count);
+  features.resize(((uint64_t) decoded_count) * layout.img_feature_stride);
+}
+
+// byte identical copies of an undecodable image are not identical images
+void fii_remove_undecodable_copies(const std::vector<uint32_t> &undecodable_findex_list,
+                                   std::unordered_map<uint32_t, std::vector<uint32_t> > &byte_copies) {
+  for(std::size_t i=0; i<undecodable_findex_list.size(); ++i) {
+    byte_copies.erase(undecodable_findex_list[i]);
+  }
+}
+
+// hash of the name, size and modification time of each file used to build the
+// filter of list2
+void fii_filter_file_hash(const std::vector<std::string> &filename_list,
+                          const std::vector<uint32_t> &filename_index_list,
+                          const std::string filename_prefix,
+                          std::vector<uint64_t> &file_hash) {
+  uint32_t file_count = filename_index_list.size();
+  file_hash.assign(file_count, 0);
+#pragma omp parallel for
+  for(uint32_t i=0; i<file_count; ++i) {
+    const std::string &filename = filename_list.at(filename_index_list[i]);
+    std::string file_path = filename_prefix + filename;
+    struct stat file_stat;
+    int64_t file_info[2] = {-1, -1};
+    if(stat(file_path.c_str(), &file_stat) == 0) {
+      file_info[0] = file_stat.st_size;
+      file_info[1] = file_stat.st_mtime;
+    }
+    std::string file_id(filename);
+    file_id.append((const char *) file_info, sizeof(file_info));
+    file_hash[i] = fii_hash64(file_id.data(), file_id.size());
+  }
+}
+
+// fingerprint of all files used to build the filter of list2, the sum of file
+// hashes does not depend on the order in which files are listed
+uint64_t fii_filter_fingerprint(const std::vector<uint64_t> &file_hash) {
+  uint64_t fingerprint = file_hash.size();
+  for(std::size_t i=0; i<file_hash.size(); ++i) {
+    fingerprint += fii_hash_fmix64(file_hash[i]);
+  }
+  return fingerprint;
+}
+
+uint32_t fii_filter_key_mode(const fii_feature_layout &layout) {
+  uint32_t key_mode = 0;
+  if(fii_is_tolerant(layout.tolerance)) {
+    key_mode |= FII_BLOOM_FILTER_KEY_COARSE;
+  }
+  if(layout.is_dihedral) {
+    key_mode |= FII_BLOOM_FILTER_KEY_DIHEDRAL;
+  }
+  return key_mode;
+}
+
+// a saved filter is used only if it was built from the same files of list2
+// using the same key and tolerance as the current search
+bool fii_filter_is_valid(const fii_bloom_filter &filter,
+                         const fii_feature_layout &layout,
+                         const uint32_t img_count2,
+                         const uint64_t fingerprint2) {
+  return filter.bits.size() &&
+    filter.key_count == img_count2 &&
+    filter.sparse_feature_count == layout.sparse_feature_count &&
+    filter.key_mode == fii_filter_key_mode(layout) &&
+    filter.max_pixel_diff == layout.tolerance.max_pixel_diff &&
+    filter.max_diff_fraction == layout.tolerance.max_diff_fraction &&
+    filter.fingerprint == fingerprint2;
+}
+
+// features of images computed before (e.g. while their key was checked against
+// a saved filter) are reused instead of decoding these images again
+struct fii_img_features {
+  std::unordered_map<uint32_t, uint64_t> row_of_findex;
+  fii_feature_vector features;
+};
+
+bool fii_copy_img_feature(const fii_img_features *img_features,
+                          const uint32_t findex,
+                          const uint64_t feature_start_index,
+                          const fii_feature_layout &layout,
+                          fii_feature_vector &features) {
+  if(img_features == NULL || img_features->row_of_findex.count(findex) == 0) {
+    return false;
+  }
+  uint64_t row = img_features->row_of_findex.at(findex);
+  std::memcpy(&features[feature_start_index],
+              &img_features->features[row * layout.img_feature_stride],
+              layout.img_feature_stride);
+  return true;
+}
+
+// Images of the larger list are decoded in chunks of FII_PROBE_CHUNK_SIZE
+// images and only the features of images whose key is present in the smaller
+// list are retained. Therefore, memory required to find identical images
+// between two lists is proportional to the size of the smaller list.
+const uint32_t FII_PROBE_CHUNK_SIZE = 4096;
+
 void fii_find_identical_img(const std::vector<std::string> &filename_list1,
                             const std::vector<uint32_t> &filename_index_list1,
                             const std::string filename_prefix1,
@@ -87,7 +1757,11 @@ void fii_find_identical_img(const std::vector<std::string> &filename_list1,
                             const std::string filename_prefix2,
                             const std::vector<uint32_t> &img_dim,
                             const std::unordered_map<std::string, std::string> &options,
-                            std::vector<std::set<uint32_t> > &image_groups) {
+                            std::vector<std::set<uint32_t> > &image_groups,
+                            fii_match_stats *stats=NULL,
+                            fii_bloom_filter *filter2=NULL,
+                            fii_img_signatures *signatures=NULL,
+                            const fii_img_features *features1=NULL) {
   image_groups.clear();
 
   uint32_t img_count1 = filename_index_list1.size();
@@ -96,25 +1770,351 @@ void fii_find_identical_img(const std::vector<std::string> &filename_list1,
     return; // identical images not possible
   }
 
-  uint64_t feature_count1 = img_count1;
-  uint64_t feature_count2 = img_count2;
-  uint32_t img_feature_count = 1;
-  bool check_all_pixels = false;
-  if(options.count("check-all-pixels")) {
-    // run exhaustive comparison of every pixel
-    // this is not necessary most of the time
-    check_all_pixels = true;
-    for(std::size_t i=0; i<img_dim.size(); ++i) {
-      feature_count1 = feature_count1 * img_dim[i];
-      feature_count2 = feature_count2 * img_dim[i];
-      img_feature_count = img_feature_count * img_dim[i];
-    }
-  } else {
-    const uint32_t FII_IMG_FEATURE_LOC_SCALE_COUNT = FII_IMG_FEATURE_LOC_SCALE.size();
-    img_feature_count = FII_IMG_FEATURE_LOC_SCALE_COUNT * FII_IMG_FEATURE_LOC_SCALE_COUNT;
-    feature_count1 = feature_count1 * img_feature_count;
-    feature_count2 = feature_count2 * img_feature_count;
-  }
+  fii_feature_layout layout;
+  fii_init_feature_layout(img_dim, options, layout);
+
+  // use all available threads by default
+  int nthread = omp_get_max_threads();
+  if(options.count("nthread")) {
+    nthread = std::atoi(options.at("nthread").c_str());
+  }
+  omp_set_dynamic(0);
+  omp_set_num_threads(nthread);
+
+  if(layout.gray_offset || layout.thumbnail_offset || layout.phash_offset ||
+     layout.crop_offset) {
+    filter2 = NULL; // these images can match an image with a different key
+  }
+  std::vector<uint64_t> file_hash2;
+  uint64_t fingerprint2 = 0;
+  if(filter2) {
+    fii_filter_file_hash(filename_list2, filename_index_list2, filename_prefix2, file_hash2);
+    fingerprint2 = fii_filter_fingerprint(file_hash2);
+  }
+  if(filter2 && fii_filter_is_valid(*filter2, layout, img_count2, fingerprint2)) {
+    // images in list1 whose key is absent in the (previously saved) filter
+    // of list2 are rejected without decoding any image in list2, features of
+    // the remaining images are retained for the search below
+    fii_img_features candidate_features1;
+    candidate_features1.features.resize(((uint64_t) img_count1) * layout.img_feature_stride);
+    std::vector<uint64_t> key1(img_count1, 0);
+    std::vector<uint8_t> is_candidate(img_count1, 0);
+    std::vector<uint8_t> is_decoded(img_count1, 0);
+#pragma omp parallel for
+    for(uint32_t i=0; i<img_count1; ++i) {
+      std::string file_path = filename_prefix1 + filename_list1.at(filename_index_list1.at(i));
+      uint64_t img_feature_start_index = ((uint64_t) i) * layout.img_feature_stride;
+      is_decoded[i] = fii_compute_img_feature(file_path, img_feature_start_index, layout,
+                                              candidate_features1.features);
+      if(is_decoded[i]) {
+        key1[i] = fii_feature_key(layout, &candidate_features1.features[img_feature_start_index]);
+        is_candidate[i] = fii_bloom_filter_contains(*filter2, key1[i]);
+      }
+    }
+    std::vector<uint32_t> candidate_index_list1;
+    std::unordered_set<uint64_t> candidate_keys;
+    for(uint32_t i=0; i<img_count1; ++i) {
+      uint32_t findex = filename_index_list1.at(i);
+      if(is_candidate[i]) {
+        candidate_features1.row_of_findex[findex] = i;
+        candidate_index_list1.push_back(findex);
+        candidate_keys.insert(key1[i]);
+      }
+      if(!is_decoded[i] && stats) {
+        stats->undecodable_file_list.push_back(filename_prefix1 + filename_list1.at(findex));
+      }
+    }
+
+    // only the images in list2 whose saved key is the key of a candidate in
+    // list1 are decoded, images without a saved key could not be decoded
+    std::vector<uint32_t> candidate_index_list2;
+    for(uint32_t i=0; i<img_count2; ++i) {
+      uint32_t findex = filename_index_list2.at(i);
+      std::unordered_map<uint64_t, uint64_t>::const_iterator ki = filter2->file_keys.find(file_hash2[i]);
+      if(ki == filter2->file_keys.end()) {
+        if(stats) {
+          stats->undecodable_file_list.push_back(filename_prefix2 + filename_list2.at(findex));
+        }
+      } else if(candidate_keys.count(ki->second)) {
+        candidate_index_list2.push_back(findex);
+      }
+    }
+    if(stats) {
+      uint64_t rejected_count = (img_count1 - candidate_index_list1.size()) +
+        (img_count2 - candidate_index_list2.size());
+      uint32_t stats_ti = fii_match_stats_tier(*stats, "sparse");
+      stats->tier_checked_count[stats_ti] += rejected_count;
+      stats->tier_rejected_count[stats_ti] += rejected_count;
+      stats->tier_value_count[stats_ti] += rejected_count * layout.sparse_feature_count;
+    }
+    if(candidate_index_list1.size() && candidate_index_list2.size()) {
+      fii_find_identical_img(filename_list1, candidate_index_list1, filename_prefix1,
+                             filename_list2, candidate_index_list2, filename_prefix2,
+                             img_dim, options, image_groups, stats,
+                             NULL, NULL, &candidate_features1);
+    }
+    return;
+  }
+  if(filter2) {
+    // filter of list2 is built while its images are decoded
+    fii_bloom_filter_init(*filter2, img_count2, layout.sparse_feature_count,
+                          fii_filter_key_mode(layout), layout.tolerance.max_pixel_diff,
+                          layout.tolerance.max_diff_fraction, fingerprint2);
+  } else if(features1 == NULL && options.count("adapt-sampling") &&
+            (img_count1 + img_count2) >= FII_ADAPTIVE_SAMPLING_MIN_IMG_COUNT) {
+    // keys saved in the filter of list2 (and features computed while these
+    // keys were checked) require the fixed sampling locations
+    std::vector<std::string> sample_path_list;
+    fii_add_adaptive_sampling_img(filename_list1, filename_index_list1, filename_prefix1,
+                                  FII_ADAPTIVE_SAMPLING_IMG_COUNT / 2, sample_path_list);
+    fii_add_adaptive_sampling_img(filename_list2, filename_index_list2, filename_prefix2,
+                                  FII_ADAPTIVE_SAMPLING_IMG_COUNT / 2, sample_path_list);
+    fii_init_adaptive_sampling(sample_path_list, img_dim, layout);
+  }
+  std::unordered_map<uint32_t, uint64_t> file_hash_of_findex2;
+  if(filter2) {
+    for(uint32_t i=0; i<img_count2; ++i) {
+      file_hash_of_findex2[filename_index_list2.at(i)] = file_hash2[i];
+    }
+  }
+
+  // byte identical copies of a file are not decoded
+  uint32_t match_findex_offset = filename_list1.size();
+  std::vector<uint32_t> rep_index_list1, rep_index_list2;
+  std::unordered_map<uint32_t, std::vector<uint32_t> > byte_copies;
+  std::unordered_map<uint32_t, std::vector<uint32_t> > byte_copies2;
+  uint32_t link_count = 0;
+  link_count += fii_find_byte_identical_files(filename_list1, filename_index_list1, filename_prefix1, 0,
+                                              fii_has_exact_tier(layout), rep_index_list1, byte_copies);
+  link_count += fii_find_byte_identical_files(filename_list2, filename_index_list2, filename_prefix2,
+                                              match_findex_offset, fii_has_exact_tier(layout),
+                                              rep_index_list2, byte_copies2);
+  byte_copies.insert(byte_copies2.begin(), byte_copies2.end());
+  img_count1 = rep_index_list1.size();
+  img_count2 = rep_index_list2.size();
+
+  // hash table is built using the smaller list and probed using the larger list
+  bool build_is_list1 = img_count1 <= img_count2;
+  const std::vector<std::string> &build_filename_list = build_is_list1 ? filename_list1 : filename_list2;
+  std::vector<uint32_t> build_index_list(build_is_list1 ? rep_index_list1 : rep_index_list2);
+  const std::string build_prefix = build_is_list1 ? filename_prefix1 : filename_prefix2;
+  uint32_t build_findex_offset = build_is_list1 ? 0 : match_findex_offset;
+  const std::vector<std::string> &probe_filename_list = build_is_list1 ? filename_list2 : filename_list1;
+  const std::vector<uint32_t> &probe_index_list = build_is_list1 ? rep_index_list2 : rep_index_list1;
+  const std::string probe_prefix = build_is_list1 ? filename_prefix2 : filename_prefix1;
+  uint32_t probe_findex_offset = build_is_list1 ? match_findex_offset : 0;
+  uint32_t build_count = build_index_list.size();
+  uint32_t probe_count = probe_index_list.size();
+
+  // pixels decoded in pass 1 are reused by the exact (or near) tier
+  fii_pixel_cache cache;
+  if(fii_has_exact_tier(layout)) {
+    fii_pixel_cache_init(cache, fii_pixel_cache_size(options));
+  }
+  bool use_cache = fii_pixel_cache_is_enabled(cache);
+
+  // build: features of images in the smaller list are [0, build_count)
+  fii_feature_vector features(((uint64_t) build_count) * layout.img_feature_stride);
+  std::vector<uint8_t> is_decoded(build_count, 0);
+#pragma omp parallel for
+  for(uint32_t i=0; i<build_count; ++i) {
+    std::string file_path = build_prefix + build_filename_list.at(build_index_list.at(i));
+    uint64_t img_feature_start_index = ((uint64_t) i) * layout.img_feature_stride;
+    std::vector<uint8_t> pixels;
+    if(build_is_list1 &&
+       fii_copy_img_feature(features1, build_index_list.at(i), img_feature_start_index, layout, features)) {
+      is_decoded[i] = 1;
+      continue;
+    }
+    is_decoded[i] = fii_compute_img_feature(file_path,
+                                            img_feature_start_index,
+                                            layout,
+                                            features,
+                                            use_cache ? &pixels : NULL);
+    if(use_cache && is_decoded[i]) {
+      // the comparisons of a build image are only known once a probe image
+      // with the same key is decoded
+      fii_pixel_cache_put(cache, build_findex_offset + build_index_list.at(i), pixels);
+    }
+  }
+  std::vector<uint32_t> undecodable_findex_list;
+  fii_remove_undecodable_img(is_decoded, layout, build_findex_offset, build_index_list,
+                             features, undecodable_findex_list);
+  build_count = build_index_list.size();
+  std::unordered_map<uint64_t, uint32_t> first_build_findex_of_key;
+  first_build_findex_of_key.reserve(build_count);
+  for(uint32_t i=0; i<build_count; ++i) {
+    if(signatures) {
+      fii_add_img_signatures(layout, &features[((uint64_t) i) * layout.img_feature_stride],
+                             build_findex_offset + build_index_list.at(i), *signatures);
+    }
+    uint64_t key = fii_feature_key(layout, &features[((uint64_t) i) * layout.img_feature_stride]);
+    first_build_findex_of_key.insert(std::make_pair(key, build_findex_offset + build_index_list.at(i)));
+    if(filter2 && !build_is_list1) {
+      fii_bloom_filter_add(*filter2, key);
+      filter2->file_keys[file_hash_of_findex2.at(build_index_list.at(i))] = key;
+    }
+  }
+
+  // probe: features of matching images in the larger list are appended
+  std::vector<uint32_t> node_findex(build_count);
+  for(uint32_t i=0; i<build_count; ++i) {
+    node_findex[i] = build_findex_offset + build_index_list.at(i);
+  }
+  fii_feature_vector chunk_features;
+  std::vector<uint8_t> chunk_is_match;
+  std::vector<uint8_t> chunk_is_decoded;
+  uint32_t probe_undecodable_count = 0;
+  for(uint32_t chunk_start=0; chunk_start<probe_count; chunk_start+=FII_PROBE_CHUNK_SIZE) {
+    uint32_t chunk_size = std::min(FII_PROBE_CHUNK_SIZE, probe_count - chunk_start);
+    chunk_features.assign(((uint64_t) chunk_size) * layout.img_feature_stride, 0);
+    chunk_is_match.assign(chunk_size, 0);
+    chunk_is_decoded.assign(chunk_size, 0);
+#pragma omp parallel for
+    for(uint32_t i=0; i<chunk_size; ++i) {
+      std::string file_path = probe_prefix + probe_filename_list.at(probe_index_list.at(chunk_start + i));
+      uint64_t img_feature_start_index = ((uint64_t) i) * layout.img_feature_stride;
+      std::vector<uint8_t> pixels;
+      if(!build_is_list1 &&
+         fii_copy_img_feature(features1, probe_index_list.at(chunk_start + i),
+                              img_feature_start_index, layout, chunk_features)) {
+        chunk_is_decoded[i] = 1;
+      } else {
+        chunk_is_decoded[i] = fii_compute_img_feature(file_path,
+                                                      img_feature_start_index,
+                                                      layout,
+                                                      chunk_features,
+                                                      use_cache ? &pixels : NULL);
+      }
+      uint64_t key = fii_feature_key(layout, &chunk_features[img_feature_start_index]);
+      std::unordered_map<uint64_t, uint32_t>::const_iterator bi = first_build_findex_of_key.find(key);
+      chunk_is_match[i] = chunk_is_decoded[i] && bi != first_build_findex_of_key.end();
+      if(use_cache && chunk_is_match[i]) {
+        // a matching probe image is compared with a build image of its key
+        // unless it is rejected by the other tiers
+        fii_pixel_cache_add_pending(cache, bi->second);
+        if(pixels.size()) {
+          fii_pixel_cache_put(cache, probe_findex_offset + probe_index_list.at(chunk_start + i), pixels, 1);
+        }
+      }
+    }
+    for(uint32_t i=0; i<chunk_size; ++i) {
+      uint64_t img_feature_start_index = ((uint64_t) i) * layout.img_feature_stride;
+      if(!chunk_is_decoded[i]) {
+        undecodable_findex_list.push_back(probe_findex_offset + probe_index_list.at(chunk_start + i));
+        probe_undecodable_count += 1;
+        continue;
+      }
+      if(filter2 && build_is_list1) {
+        uint64_t key = fii_feature_key(layout, &chunk_features[img_feature_start_index]);
+        fii_bloom_filter_add(*filter2, key);
+        filter2->file_keys[file_hash_of_findex2.at(probe_index_list.at(chunk_start + i))] = key;
+      }
+      if(signatures) {
+        fii_add_img_signatures(layout, &chunk_features[img_feature_start_index],
+                               probe_findex_offset + probe_index_list.at(chunk_start + i),
+                               *signatures);
+      }
+      if(!chunk_is_match[i]) {
+        continue;
+      }
+      features.insert(features.end(),
+                      chunk_features.begin() + img_feature_start_index,
+                      chunk_features.begin() + img_feature_start_index + layout.img_feature_stride);
+      node_findex.push_back(probe_findex_offset + probe_index_list.at(chunk_start + i));
+    }
+  }
+  fii_feature_vector().swap(chunk_features);
+  if(filter2) {
+    // byte identical copies of an image in list2 have the same key
+    std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator bi;
+    for(bi=byte_copies2.begin(); bi!=byte_copies2.end(); ++bi) {
+      uint64_t rep_file_hash = file_hash_of_findex2.at(bi->first - match_findex_offset);
+      if(filter2->file_keys.count(rep_file_hash) == 0) {
+        continue; // undecodable image
+      }
+      uint64_t key = filter2->file_keys.at(rep_file_hash);
+      for(std::size_t ci=0; ci<bi->second.size(); ++ci) {
+        filter2->file_keys[file_hash_of_findex2.at(bi->second[ci] - match_findex_offset)] = key;
+      }
+    }
+  }
+  if(signatures) {
+    fii_add_byte_copy_signatures(byte_copies, *signatures);
+  }
+
+  uint32_t img_count = node_findex.size();
+  fii_union_find image_sets;
+  fii_union_find_init(image_sets, img_count);
+  std::vector<uint64_t> tier_checked_count, tier_rejected_count;
+  fii_group_identical_features(features, img_count, build_count, layout,
+                               image_sets, tier_checked_count, tier_rejected_count);
+  // probe images not present in the hash table are rejected by sparse features
+  uint32_t probe_decoded_count = probe_count - probe_undecodable_count;
+  tier_checked_count[0] += probe_decoded_count - (img_count - build_count);
+  tier_rejected_count[0] += probe_decoded_count - (img_count - build_count);
+
+  // each set of images connected by a match is a group of identical images,
+  // groups are ordered by their first image irrespective of the build list
+  fii_union_find_groups(image_sets, node_findex, image_groups);
+  std::sort(image_groups.begin(), image_groups.end(),
+            [](const std::set<uint32_t> &a, const std::set<uint32_t> &b) {
+              return *a.begin() < *b.begin();
+            });
+
+  // pass 2 only needs the candidate groups and therefore, memory used by the
+  // features of all images is released before the images are decoded again
+  fii_feature_vector().swap(features);
+  std::vector<std::atomic<uint32_t> >().swap(image_sets.parent);
+
+  uint64_t exact_checked_count = 0;
+  uint64_t exact_rejected_count = 0;
+  if(fii_has_exact_tier(layout)) {
+    exact_checked_count = fii_candidate_img_count(image_groups);
+    fii_pixel_cache_retain(cache, image_groups);
+    fii_confirm_identical_img(filename_list1, filename_prefix1,
+                              filename_list2, filename_prefix2,
+                              image_groups, layout.tolerance,
+                              layout.is_dihedral, use_cache ? &cache : NULL);
+    exact_rejected_count = exact_checked_count - fii_candidate_img_count(image_groups);
+  }
+  // copies of an image only match if the image matches an image in the other list
+  fii_add_byte_identical_files(byte_copies, false, image_groups);
+  fii_update_match_stats(layout, img_dim, img_count1 + img_count2,
+                         tier_checked_count, tier_rejected_count,
+                         exact_checked_count, exact_rejected_count, stats);
+  if(stats) {
+    stats->byte_identical_count += fii_byte_identical_file_count(byte_copies) - link_count;
+    stats->hardlink_count += link_count;
+    stats->pixel_cache_hit_count += cache.hit_count;
+    for(std::size_t i=0; i<undecodable_findex_list.size(); ++i) {
+      uint32_t findex = undecodable_findex_list[i];
+      if(findex >= match_findex_offset) {
+        stats->undecodable_file_list.push_back(filename_prefix2 + filename_list2.at(findex - match_findex_offset));
+      } else {
+        stats->undecodable_file_list.push_back(filename_prefix1 + filename_list1.at(findex));
+      }
+    }
+  }
+}
+
+void fii_find_identical_img(const std::vector<std::string> &filename_list,
+                            const std::vector<uint32_t> &filename_index_list,
+                            const std::string filename_prefix,
+                            const std::vector<uint32_t> &img_dim,
+                            const std::unordered_map<std::string, std::string> &options,
+                            std::vector<std::set<uint32_t> > &image_groups,
+                            fii_match_stats *stats=NULL,
+                            fii_img_signatures *signatures=NULL) {
+  image_groups.clear();
+
+  uint32_t img_count = filename_index_list.size();
+  if(img_count < 2) {
+    return; // identical images not possible
+  }
+
+  fii_feature_layout layout;
+  fii_init_feature_layout(img_dim, options, layout);
 
   // use all available threads by default
   int nthread = omp_get_max_threads();
@@ -124,245 +2124,821 @@ void fii_find_identical_img(const std::vector<std::string> &filename_list1,
   omp_set_dynamic(0);
   omp_set_num_threads(nthread);
 
-  // extract features from filename_index_list1
-  std::vector<uint8_t> features1(feature_count1);
-#pragma omp parallel for
-  for(uint32_t i=0; i<img_count1; ++i) {
-    uint32_t filename_index1 = filename_index_list1.at(i);
-    std::string file_path1 = filename_prefix1 + filename_list1.at(filename_index1);
+  // byte identical copies of a file are not decoded
+  std::vector<uint32_t> rep_index_list;
+  std::unordered_map<uint32_t, std::vector<uint32_t> > byte_copies;
+  uint32_t link_count = fii_find_byte_identical_files(filename_list, filename_index_list, filename_prefix, 0,
+                                                      fii_has_exact_tier(layout), rep_index_list, byte_copies);
+  img_count = rep_index_list.size();
+
+  if(options.count("adapt-sampling") && img_count >= FII_ADAPTIVE_SAMPLING_MIN_IMG_COUNT) {
+    std::vector<std::string> sample_path_list;
+    fii_add_adaptive_sampling_img(filename_list, rep_index_list, filename_prefix,
+                                  FII_ADAPTIVE_SAMPLING_IMG_COUNT, sample_path_list);
+    fii_init_adaptive_sampling(sample_path_list, img_dim, layout);
+  }
 
-    uint64_t img_feature_start_index = i * img_feature_count;
-    fii_compute_img_feature(file_path1,
-                            img_feature_start_index,
-                            img_feature_count,
-                            features1,
-                            check_all_pixels);
+  // pixels decoded in pass 1 are reused by the exact (or near) tier
+  fii_pixel_cache cache;
+  if(fii_has_exact_tier(layout)) {
+    fii_pixel_cache_init(cache, fii_pixel_cache_size(options));
   }
+  bool use_cache = fii_pixel_cache_is_enabled(cache);
 
-  // extract features from filename_index_list1
-  std::vector<uint8_t> features2(feature_count2);
+  fii_feature_vector features(((uint64_t) img_count) * layout.img_feature_stride);
+  std::vector<uint8_t> is_decoded(img_count, 0);
 #pragma omp parallel for
-  for(uint32_t i=0; i<img_count2; ++i) {
-    uint32_t filename_index2 = filename_index_list2.at(i);
-    std::string file_path2 = filename_prefix2 + filename_list2.at(filename_index2);
+  for(uint32_t i=0; i<img_count; ++i) {
+    uint32_t filename_index = rep_index_list.at(i);
+    std::string file_path = filename_prefix + filename_list.at(filename_index);
+
+    uint64_t img_feature_start_index = ((uint64_t) i) * layout.img_feature_stride;
 
-    uint64_t img_feature_start_index = i * img_feature_count;
-    fii_compute_img_feature(file_path2,
-                            img_feature_start_index,
-                            img_feature_count,
-                            features2,
-                            check_all_pixels);
+    std::vector<uint8_t> pixels;
+    is_decoded[i] = fii_compute_img_feature(file_path,
+                                            img_feature_start_index,
+                                            layout,
+                                            features,
+                                            use_cache ? &pixels : NULL);
+    if(use_cache && is_decoded[i]) {
+      // an image with the same key as an earlier image is a candidate
+      uint64_t key = fii_feature_key(layout, &features[img_feature_start_index]);
+      fii_pixel_cache_put_keyed(cache, filename_index, key, pixels);
+    }
   }
+  std::vector<uint32_t> undecodable_findex_list;
+  fii_remove_undecodable_img(is_decoded, layout, 0, rep_index_list,
+                             features, undecodable_findex_list);
+  img_count = rep_index_list.size();
+  uint64_t byte_identical_count = fii_byte_identical_file_count(byte_copies);
+  fii_remove_undecodable_copies(undecodable_findex_list, byte_copies);
 
-  // compute image graph between each image
-  std::unordered_map<uint32_t, std::set<uint32_t> > match_graph;
-  std::unordered_map<uint32_t, uint8_t> vertex_flag;
-  uint32_t match_findex_offset = filename_list1.size();
-  for(uint32_t qi=0; qi<img_count1; ++qi) {
-    for(uint32_t mj=0; mj<img_count2; ++mj) {
-      // check if the distance between query qi and match mj is 0
-      bool distance_is_zero = true;
-      for(uint32_t fi=0; fi<img_feature_count; ++fi) {
-        if( (features1[qi*img_feature_count + fi] ^ features2[mj*img_feature_count + fi]) != 0 ) {
-          distance_is_zero = false;
-          break;
-        }
+  if(signatures) {
+    for(uint32_t i=0; i<img_count; ++i) {
+      fii_add_img_signatures(layout, &features[((uint64_t) i) * layout.img_feature_stride],
+                             rep_index_list.at(i), *signatures);
+    }
+    fii_add_byte_copy_signatures(byte_copies, *signatures);
+  }
+
+  fii_union_find image_sets;
+  fii_union_find_init(image_sets, img_count);
+  std::vector<uint64_t> tier_checked_count, tier_rejected_count;
+  fii_group_identical_features(features, img_count, img_count, layout,
+                               image_sets, tier_checked_count, tier_rejected_count);
+
+  // each set containing more than one image is a group of identical images
+  fii_union_find_groups(image_sets, rep_index_list, image_groups);
+
+  // pass 2 only needs the candidate groups and therefore, memory used by the
+  // features of all images is released before the images are decoded again
+  fii_feature_vector().swap(features);
+  std::vector<std::atomic<uint32_t> >().swap(image_sets.parent);
+
+  uint64_t exact_checked_count = 0;
+  uint64_t exact_rejected_count = 0;
+  if(fii_has_exact_tier(layout)) {
+    exact_checked_count = fii_candidate_img_count(image_groups);
+    fii_pixel_cache_retain(cache, image_groups);
+    fii_confirm_identical_img(filename_list, filename_prefix,
+                              std::vector<std::string>(), "",
+                              image_groups, layout.tolerance,
+                              layout.is_dihedral, use_cache ? &cache : NULL);
+    exact_rejected_count = exact_checked_count - fii_candidate_img_count(image_groups);
+  }
+  fii_add_byte_identical_files(byte_copies, true, image_groups);
+  fii_update_match_stats(layout, img_dim, img_count,
+                         tier_checked_count, tier_rejected_count,
+                         exact_checked_count, exact_rejected_count, stats);
+  if(stats) {
+    stats->byte_identical_count += byte_identical_count - link_count;
+    stats->hardlink_count += link_count;
+    stats->pixel_cache_hit_count += cache.hit_count;
+    for(std::size_t i=0; i<undecodable_findex_list.size(); ++i) {
+      stats->undecodable_file_list.push_back(filename_prefix + filename_list.at(undecodable_findex_list[i]));
+    }
+  }
+}
+
+std::string fii_img_dim_id(const int &width,
+                           const int &height,
+                           const int &nchannel) {
+  std::ostringstream ss;
+  ss << width << "x" << height << "x" << nchannel;
+  return ss.str();
+}
+
+// Buckets whose signatures were not computed while comparing images (e.g. a
+// bucket containing a single image) but are needed to match images across
+// buckets: all buckets for --find-resized, --near-identical or --find-crops
+// and, for --match-gray, the WxHx1 and WxHx3 buckets whose counterpart exists
+// in bucket_img_dim_list1 or bucket_img_dim_list2
+std::set<std::string> fii_signature_bucket_id_list(const std::unordered_map<std::string, std::vector<uint32_t> > &bucket_img_dim_list1,
+                                                   const std::unordered_map<std::string, std::vector<uint32_t> > &bucket_img_dim_list2,
+                                                   const std::unordered_map<std::string, fii_img_signatures> &signatures,
+                                                   const std::unordered_map<std::string, std::string> &options) {
+  std::set<std::string> bucket_id_list;
+  const std::unordered_map<std::string, std::vector<uint32_t> > *dim_lists[2] = { &bucket_img_dim_list1, &bucket_img_dim_list2 };
+  for(int k=0; k<2; ++k) {
+    std::unordered_map<std::string, std::vector<uint32_t> >::const_iterator it;
+    for(it=dim_lists[k]->begin(); it!=dim_lists[k]->end(); ++it) {
+      const std::vector<uint32_t> &img_dim = it->second;
+      if(img_dim[0] == 0 || signatures.count(it->first)) {
+        continue;
+      }
+      if(options.count("find-resized") || options.count("near-identical") ||
+         options.count("find-crops")) {
+        bucket_id_list.insert(it->first);
+        continue;
+      }
+      if(img_dim[2] != 1 && img_dim[2] != 3) {
+        continue;
+      }
+      std::string pair_bucket_id = fii_img_dim_id(img_dim[0], img_dim[1], img_dim[2] == 1 ? 3 : 1);
+      if(bucket_img_dim_list1.count(pair_bucket_id) ||
+         bucket_img_dim_list2.count(pair_bucket_id)) {
+        bucket_id_list.insert(it->first);
+      }
+    }
+  }
+  return bucket_id_list;
+}
+
+void fii_compute_img_signatures(const std::vector<std::string> &filename_list,
+                                const std::string filename_prefix,
+                                const uint32_t findex_offset,
+                                const std::unordered_map<std::string, std::vector<uint32_t> > &buckets_of_img_index,
+                                const std::unordered_map<std::string, std::vector<uint32_t> > &bucket_img_dim_list,
+                                const std::set<std::string> &bucket_id_list,
+                                const std::unordered_map<std::string, std::string> &options,
+                                std::unordered_map<std::string, fii_img_signatures> &signatures) {
+  std::set<std::string>::const_iterator bi;
+  for(bi=bucket_id_list.begin(); bi!=bucket_id_list.end(); ++bi) {
+    if(buckets_of_img_index.count(*bi) == 0) {
+      continue;
+    }
+    const std::vector<uint32_t> &filename_index_list = buckets_of_img_index.at(*bi);
+    uint32_t img_count = filename_index_list.size();
+
+    // only the signatures are computed
+    fii_feature_layout layout;
+    fii_init_feature_layout(bucket_img_dim_list.at(*bi), options, layout);
+    layout.tiers.clear();
+    layout.img_feature_count = std::max(layout.gray_offset + FII_GRAY_SIGNATURE_SIZE,
+                                        layout.thumbnail_offset + FII_THUMBNAIL_VALUE_COUNT);
+    layout.img_feature_count = std::max(layout.img_feature_count,
+                                        layout.phash_offset + (uint32_t) sizeof(uint64_t));
+    layout.img_feature_count = std::max(layout.img_feature_count,
+                                        layout.crop_offset + FII_CROP_SIGNATURE_SIZE);
+    layout.img_feature_stride = fii_feature_stride(layout.img_feature_count);
+    fii_feature_vector features(((uint64_t) img_count) * layout.img_feature_stride);
+    std::vector<uint8_t> is_decoded(img_count, 0);
+#pragma omp parallel for
+    for(uint32_t i=0; i<img_count; ++i) {
+      std::string file_path = filename_prefix + filename_list.at(filename_index_list.at(i));
+      is_decoded[i] = fii_compute_img_feature(file_path,
+                                              ((uint64_t) i) * layout.img_feature_stride,
+                                              layout,
+                                              features);
+    }
+    fii_img_signatures &bucket_signatures = signatures[*bi];
+    for(uint32_t i=0; i<img_count; ++i) {
+      if(!is_decoded[i]) {
+        continue;
+      }
+      fii_add_img_signatures(layout, &features[((uint64_t) i) * layout.img_feature_stride],
+                             findex_offset + filename_index_list.at(i), bucket_signatures);
+    }
+  }
+}
+
+// Join the groups of identical images in WxHx1 and WxHx3 buckets when a
+// grayscale image stored using three channels has the same gray signature as
+// a grayscale image. Joined groups are moved to the WxHx1 bucket and their
+// (bucket_id, group_id) is appended to joined_groups. If findex_offset is not
+// 0, images with findex >= findex_offset are from filename_list2 and a group
+// must contain images from both the lists. Returns the number of images that
+// were added to a group of identical images.
+uint32_t fii_join_gray_buckets(const std::unordered_map<std::string, fii_img_signatures> &signatures,
+                               const std::unordered_map<std::string, std::vector<uint32_t> > &bucket_img_dim_list,
+                               const std::unordered_map<std::string, std::string> &options,
+                               const std::vector<std::string> &filename_list1,
+                               const std::string filename_prefix1,
+                               const std::vector<std::string> &filename_list2,
+                               const std::string filename_prefix2,
+                               std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
+                               std::vector<std::pair<std::string, uint32_t> > &joined_groups) {
+  uint32_t findex_offset = filename_list2.size() ? filename_list1.size() : 0;
+  uint32_t joined_img_count = 0;
+  std::unordered_map<std::string, fii_img_signatures>::const_iterator it;
+  for(it=signatures.begin(); it!=signatures.end(); ++it) {
+    const std::string &rgb_bucket_id = it->first;
+    const std::vector<fii_gray_signature> &rgb_list = it->second.gray;
+    const std::vector<uint32_t> &img_dim = bucket_img_dim_list.at(rgb_bucket_id);
+    if(img_dim[2] != 3) {
+      continue;
+    }
+    std::string gray_bucket_id = fii_img_dim_id(img_dim[0], img_dim[1], 1);
+    if(signatures.count(gray_bucket_id) == 0 || rgb_list.size() == 0) {
+      continue;
+    }
+
+    // hash table of grayscale images is probed using the grayscale images
+    // stored using three channels
+    const std::vector<fii_gray_signature> &gray_list = signatures.at(gray_bucket_id).gray;
+    std::map<std::pair<uint64_t, uint64_t>, std::vector<uint32_t> > gray_findex_of_hash;
+    for(std::size_t i=0; i<gray_list.size(); ++i) {
+      gray_findex_of_hash[std::make_pair(gray_list[i].hash[0], gray_list[i].hash[1])].push_back(gray_list[i].findex);
+    }
+    std::vector<std::pair<uint32_t, uint32_t> > matches;
+    for(std::size_t i=0; i<rgb_list.size(); ++i) {
+      const fii_gray_signature &signature = rgb_list[i];
+      std::map<std::pair<uint64_t, uint64_t>, std::vector<uint32_t> >::const_iterator gi;
+      gi = gray_findex_of_hash.find(std::make_pair(signature.hash[0], signature.hash[1]));
+      if(gi == gray_findex_of_hash.end()) {
+        continue;
       }
-      if(distance_is_zero) {
-        uint32_t qindex = filename_index_list1.at(qi);
-        uint32_t mindex = match_findex_offset + filename_index_list2.at(mj);
-        // insert undirected edge between query and match
-        if(match_graph.find(qindex) == match_graph.end()) {
-          match_graph[qindex] = std::set<uint32_t>();
+      for(std::size_t j=0; j<gi->second.size(); ++j) {
+        matches.push_back(std::make_pair(gi->second[j], signature.findex));
+      }
+    }
+    if(matches.size() == 0) {
+      continue;
+    }
+
+    // matching images are compared pixel by pixel only if exact tier is used
+    fii_feature_layout layout;
+    fii_init_feature_layout(img_dim, options, layout);
+    if(fii_has_exact_tier(layout)) {
+      std::vector<uint8_t> is_confirmed(matches.size(), 0);
+#pragma omp parallel for schedule(dynamic)
+      for(std::size_t mi=0; mi<matches.size(); ++mi) {
+        std::vector<uint8_t> gray_pixels, rgb_pixels;
+        uint32_t findex[2] = { matches[mi].first, matches[mi].second };
+        std::vector<uint8_t> *pixels[2] = { &gray_pixels, &rgb_pixels };
+        for(int k=0; k<2; ++k) {
+          if(findex_offset && findex[k] >= findex_offset) {
+            fii_load_img_pixels(filename_prefix2 + filename_list2.at(findex[k] - findex_offset), *pixels[k], layout.is_dihedral);
+          } else {
+            fii_load_img_pixels(filename_prefix1 + filename_list1.at(findex[k]), *pixels[k], layout.is_dihedral);
+          }
         }
-        if(match_graph.find(mindex) == match_graph.end()) {
-          match_graph[mindex] = std::set<uint32_t>();
+        if(gray_pixels.size() == 0 || rgb_pixels.size() != 3 * gray_pixels.size()) {
+          continue;
         }
-        match_graph[qindex].insert(mindex);
-        match_graph[mindex].insert(qindex);
-        // maintain vertex list
-        if(vertex_flag.count(qindex) == 0) {
-          vertex_flag[qindex] = 0;
+        bool is_equal = true;
+        for(std::size_t i=0; i<gray_pixels.size() && is_equal; ++i) {
+          is_equal = rgb_pixels[3 * i] == gray_pixels[i];
         }
-        if(vertex_flag.count(mindex) == 0) {
-          vertex_flag[mindex] = 0;
+        is_confirmed[mi] = is_equal;
+      }
+      std::vector<std::pair<uint32_t, uint32_t> > confirmed_matches;
+      for(std::size_t mi=0; mi<matches.size(); ++mi) {
+        if(is_confirmed[mi]) {
+          confirmed_matches.push_back(matches[mi]);
         }
       }
+      matches.swap(confirmed_matches);
     }
-  }
 
-  // perform depth first search to find all the connected components
-  std::unordered_map<uint32_t, std::set<uint32_t> >::const_iterator itr;
-  for(itr=match_graph.begin(); itr!=match_graph.end(); ++itr) {
-    uint32_t query_id = itr->first;
+    // groups of both buckets and the matching images are merged
+    std::vector<std::set<uint32_t> > &gray_groups = image_groups[gray_bucket_id];
+    std::vector<std::set<uint32_t> > &rgb_groups = image_groups[rgb_bucket_id];
+    std::unordered_map<uint32_t, uint32_t> node_of_findex;
+    std::vector<uint32_t> node_findex;
+    std::vector<std::set<uint32_t> > *bucket_groups[2] = { &gray_groups, &rgb_groups };
+    for(int k=0; k<2; ++k) {
+      for(std::size_t gi=0; gi<bucket_groups[k]->size(); ++gi) {
+        std::set<uint32_t>::const_iterator si;
+        for(si=bucket_groups[k]->at(gi).begin(); si!=bucket_groups[k]->at(gi).end(); ++si) {
+          node_of_findex[*si] = node_findex.size();
+          node_findex.push_back(*si);
+        }
+      }
+    }
+    for(std::size_t mi=0; mi<matches.size(); ++mi) {
+      uint32_t findex[2] = { matches[mi].first, matches[mi].second };
+      for(int k=0; k<2; ++k) {
+        if(node_of_findex.count(findex[k]) == 0) {
+          node_of_findex[ findex[k] ] = node_findex.size();
+          node_findex.push_back(findex[k]);
+        }
+      }
+    }
+    fii_union_find uf;
+    fii_union_find_init(uf, node_findex.size());
+    for(int k=0; k<2; ++k) {
+      for(std::size_t gi=0; gi<bucket_groups[k]->size(); ++gi) {
+        uint32_t first_node = node_of_findex.at(*(bucket_groups[k]->at(gi).begin()));
+        std::set<uint32_t>::const_iterator si;
+        for(si=bucket_groups[k]->at(gi).begin(); si!=bucket_groups[k]->at(gi).end(); ++si) {
+          fii_union_find_merge(uf, first_node, node_of_findex.at(*si));
+        }
+      }
+    }
+    for(std::size_t mi=0; mi<matches.size(); ++mi) {
+      fii_union_find_merge(uf, node_of_findex.at(matches[mi].first), node_of_findex.at(matches[mi].second));
+    }
+    std::vector<std::set<uint32_t> > groups;
+    fii_union_find_groups(uf, node_findex, groups);
 
-    if(vertex_flag[query_id] == 1) {
-      continue; // discard already visited nodes
+    // only the groups containing a matching pair are joined
+    std::set<uint32_t> matched_findex;
+    for(std::size_t mi=0; mi<matches.size(); ++mi) {
+      matched_findex.insert(matches[mi].first);
     }
-    std::set<uint32_t> match_id_list(itr->second);
-    std::set<uint32_t> visited_nodes;
-    std::set<uint32_t>::const_iterator mitr = match_id_list.begin();
-    for(; mitr != match_id_list.end(); ++mitr) {
-      uint32_t match_id = *mitr;
-      if(vertex_flag[match_id] == 1) {
-        continue; // discard already visited nodes
+    std::vector<std::set<uint32_t> > joined;
+    std::set<uint32_t> joined_findex;
+    for(std::size_t gi=0; gi<groups.size(); ++gi) {
+      const std::set<uint32_t> &group = groups[gi];
+      bool has_match = false;
+      std::set<uint32_t>::const_iterator si;
+      for(si=group.begin(); si!=group.end() && !has_match; ++si) {
+        has_match = matched_findex.count(*si);
       }
-      vertex_flag[match_id] = 1;
-      visited_nodes.insert(match_id);
-      fii_depth_first_search(match_graph, vertex_flag, match_id, visited_nodes);
+      if(!has_match) {
+        continue;
+      }
+      if(findex_offset &&
+         ((*group.begin()) >= findex_offset || (*group.rbegin()) < findex_offset)) {
+        continue; // images from only one list
+      }
+      joined.push_back(group);
+      joined_findex.insert(group.begin(), group.end());
+    }
+
+    // groups that were not joined remain in their bucket
+    for(int k=0; k<2; ++k) {
+      std::vector<std::set<uint32_t> > remaining_groups;
+      for(std::size_t gi=0; gi<bucket_groups[k]->size(); ++gi) {
+        const std::set<uint32_t> &group = bucket_groups[k]->at(gi);
+        if(joined_findex.count(*group.begin())) {
+          joined_img_count -= group.size() - 1;
+        } else {
+          remaining_groups.push_back(group);
+        }
+      }
+      bucket_groups[k]->swap(remaining_groups);
+    }
+    for(std::size_t ji=0; ji<joined.size(); ++ji) {
+      joined_img_count += joined[ji].size() - 1;
+      joined_groups.push_back(std::make_pair(gray_bucket_id, gray_groups.size()));
+      gray_groups.push_back(joined[ji]);
+    }
+    if(rgb_groups.size() == 0) {
+      image_groups.erase(rgb_bucket_id);
     }
-    if(visited_nodes.size() == 0) {
-      continue; // discard empty components
+    if(image_groups[gray_bucket_id].size() == 0) {
+      image_groups.erase(gray_bucket_id);
     }
-    //visited_nodes.push_back(query_id); // add query node
-    image_groups.push_back(visited_nodes);
   }
+  return joined_img_count;
 }
 
-void fii_find_identical_img(const std::vector<std::string> &filename_list,
-                            const std::vector<uint32_t> &filename_index_list,
-                            const std::string filename_prefix,
-                            const std::vector<uint32_t> &img_dim,
-                            const std::unordered_map<std::string, std::string> &options,
-                            std::vector<std::set<uint32_t> > &image_groups) {
-  image_groups.clear();
-
-  uint32_t img_count = filename_index_list.size();
-  if(img_count < 2) {
-    return; // identical images not possible
+// keys of a thumbnail in the index of resized images: with_probe adds the
+// keys obtained by moving the values close to a level boundary (of at most
+// FII_RESIZED_MAX_PROBE_CELL cells) to their neighbouring level
+void fii_resized_keys(const fii_thumbnail &thumbnail,
+                      const bool with_probe,
+                      std::vector<uint64_t> &keys) {
+  const uint32_t cell_size = FII_THUMBNAIL_SIZE / FII_RESIZED_KEY_GRID_SIZE;
+  const uint32_t level_size = 256 / FII_RESIZED_KEY_LEVEL_COUNT;
+  uint8_t level[1 + FII_RESIZED_KEY_GRID_SIZE * FII_RESIZED_KEY_GRID_SIZE];
+  std::vector<std::pair<uint32_t, uint8_t> > probe_level;
+  level[0] = thumbnail.nchannel;
+  for(uint32_t ky=0; ky<FII_RESIZED_KEY_GRID_SIZE; ++ky) {
+    for(uint32_t kx=0; kx<FII_RESIZED_KEY_GRID_SIZE; ++kx) {
+      uint32_t sum = 0;
+      for(uint32_t y=ky*cell_size; y<(ky+1)*cell_size; ++y) {
+        for(uint32_t x=kx*cell_size; x<(kx+1)*cell_size; ++x) {
+          sum += thumbnail.value[y * FII_THUMBNAIL_SIZE + x];
+        }
+      }
+      uint32_t value = sum / (cell_size * cell_size);
+      uint32_t i = 1 + ky * FII_RESIZED_KEY_GRID_SIZE + kx;
+      level[i] = value / level_size;
+      if(!with_probe || probe_level.size() == FII_RESIZED_MAX_PROBE_CELL) {
+        continue;
+      }
+      if((value % level_size) < FII_RESIZED_KEY_MARGIN && level[i] > 0) {
+        probe_level.push_back(std::make_pair(i, level[i] - 1));
+      } else if((level_size - (value % level_size)) <= FII_RESIZED_KEY_MARGIN &&
+                level[i] < (FII_RESIZED_KEY_LEVEL_COUNT - 1)) {
+        probe_level.push_back(std::make_pair(i, level[i] + 1));
+      }
+    }
+  }
+  keys.clear();
+  uint32_t probe_count = 1 << probe_level.size();
+  for(uint32_t probe=0; probe<probe_count; ++probe) {
+    uint8_t probe_key[sizeof(level)];
+    std::memcpy(probe_key, level, sizeof(level));
+    for(std::size_t pi=0; pi<probe_level.size(); ++pi) {
+      if(probe & (1 << pi)) {
+        probe_key[ probe_level[pi].first ] = probe_level[pi].second;
+      }
+    }
+    keys.push_back(fii_hash64(probe_key, sizeof(probe_key)));
   }
+}
 
-  uint32_t img_feature_count = 1;
-  uint64_t feature_count = img_count;
-  bool check_all_pixels = false;
-  if(options.count("check-all-pixels")) {
-    check_all_pixels = true;
-    for(std::size_t i=0; i<img_dim.size(); ++i) {
-      feature_count = feature_count * img_dim[i];
-      img_feature_count = img_feature_count * img_dim[i];
+// downscale (or upscale) an image by averaging the pixels of src covered by
+// each pixel of dst
+void fii_resize_img_area(const std::vector<uint8_t> &src,
+                         const uint32_t src_width,
+                         const uint32_t src_height,
+                         const uint32_t nchannel,
+                         const uint32_t dst_width,
+                         const uint32_t dst_height,
+                         std::vector<uint8_t> &dst) {
+  dst.resize(((uint64_t) dst_width) * dst_height * nchannel);
+  for(uint32_t dy=0; dy<dst_height; ++dy) {
+    uint64_t y0 = (((uint64_t) dy) * src_height) / dst_height;
+    uint64_t y1 = std::max(y0 + 1, (((uint64_t) dy + 1) * src_height) / dst_height);
+    for(uint32_t dx=0; dx<dst_width; ++dx) {
+      uint64_t x0 = (((uint64_t) dx) * src_width) / dst_width;
+      uint64_t x1 = std::max(x0 + 1, (((uint64_t) dx + 1) * src_width) / dst_width);
+      uint64_t count = (y1 - y0) * (x1 - x0);
+      for(uint32_t c=0; c<nchannel; ++c) {
+        uint64_t sum = 0;
+        for(uint64_t y=y0; y<y1; ++y) {
+          for(uint64_t x=x0; x<x1; ++x) {
+            sum += src[(y * src_width + x) * nchannel + c];
+          }
+        }
+        dst[(((uint64_t) dy) * dst_width + dx) * nchannel + c] = (sum + count / 2) / count;
+      }
     }
-  } else {
-    const uint32_t FII_IMG_FEATURE_LOC_SCALE_COUNT = FII_IMG_FEATURE_LOC_SCALE.size();
-    img_feature_count = FII_IMG_FEATURE_LOC_SCALE_COUNT * FII_IMG_FEATURE_LOC_SCALE_COUNT;
-    feature_count = img_count * img_feature_count;
   }
+}
 
-  std::vector<uint8_t> features(feature_count);
+// Find groups of images that are resized copies of each other using the
+// thumbnails of images of all buckets. If filename_list2 is not empty, images
+// with findex >= filename_list1.size() are from filename_list2 and only the
+// resized copies between the two lists are found.
+void fii_find_resized_img(const std::unordered_map<std::string, fii_img_signatures> &signatures,
+                          const std::unordered_map<std::string, std::string> &options,
+                          const std::vector<std::string> &filename_list1,
+                          const std::string filename_prefix1,
+                          const std::vector<std::string> &filename_list2,
+                          const std::string filename_prefix2,
+                          std::vector<std::set<uint32_t> > &resized_groups) {
+  resized_groups.clear();
+  uint32_t findex_offset = filename_list2.size() ? filename_list1.size() : 0;
+  std::vector<const fii_thumbnail *> thumbnails;
+  std::unordered_map<std::string, fii_img_signatures>::const_iterator it;
+  for(it=signatures.begin(); it!=signatures.end(); ++it) {
+    for(std::size_t i=0; i<it->second.thumbnail.size(); ++i) {
+      const fii_thumbnail &thumbnail = it->second.thumbnail[i];
+      uint8_t min_value = *std::min_element(thumbnail.value, thumbnail.value + FII_THUMBNAIL_VALUE_COUNT);
+      uint8_t max_value = *std::max_element(thumbnail.value, thumbnail.value + FII_THUMBNAIL_VALUE_COUNT);
+      if(((uint32_t) (max_value - min_value)) >= FII_RESIZED_MIN_CONTRAST) {
+        thumbnails.push_back(&thumbnail);
+      }
+    }
+  }
 
-  // use all available threads by default
-  int nthread = omp_get_max_threads();
-  if(options.count("nthread")) {
-    nthread = std::atoi(options.at("nthread").c_str());
+  // images of a key are grouped by their dimension such that images with the
+  // same dimension (compared using their features) are skipped at once
+  typedef std::unordered_map<uint64_t, std::vector<uint32_t> > fii_thumbnails_of_dim;
+  std::unordered_map<uint64_t, fii_thumbnails_of_dim> thumbnails_of_key;
+  std::unordered_map<uint64_t, uint32_t> img_count_of_key;
+  std::vector<uint64_t> keys;
+  for(uint32_t i=0; i<thumbnails.size(); ++i) {
+    fii_resized_keys(*thumbnails[i], false, keys);
+    uint64_t dim = (((uint64_t) thumbnails[i]->width) << 32) | thumbnails[i]->height;
+    thumbnails_of_key[ keys[0] ][dim].push_back(i);
+    img_count_of_key[ keys[0] ] += 1;
   }
-  omp_set_dynamic(0);
-  omp_set_num_threads(nthread);
 
-#pragma omp parallel for
-  for(uint32_t i=0; i<img_count; ++i) {
-    uint32_t filename_index = filename_index_list.at(i);
-    std::string file_path = filename_prefix + filename_list.at(filename_index);
+  // keys shared by a very large number of images (e.g. of similar scanned
+  // documents) would need a quadratic number of comparisons
+  uint32_t skipped_key_count = 0;
+  uint32_t skipped_img_count = 0;
+  std::unordered_map<uint64_t, uint32_t>::const_iterator kc;
+  for(kc=img_count_of_key.begin(); kc!=img_count_of_key.end(); ++kc) {
+    if(kc->second > FII_RESIZED_MAX_KEY_IMG_COUNT) {
+      thumbnails_of_key.erase(kc->first);
+      skipped_key_count += 1;
+      skipped_img_count += kc->second;
+    }
+  }
+  if(skipped_key_count) {
+    std::cout << "Skipped " << skipped_img_count << " images sharing "
+              << skipped_key_count << " thumbnail keys with more than "
+              << FII_RESIZED_MAX_KEY_IMG_COUNT << " images in the search of resized copies"
+              << std::endl;
+  }
 
-    uint64_t img_feature_start_index = i * img_feature_count;
-
-    fii_compute_img_feature(file_path,
-                            img_feature_start_index,
-                            img_feature_count,
-                            features,
-                            check_all_pixels);
-  }
-
-  // compute image graph between each image
-  std::unordered_map<uint32_t, std::set<uint32_t> > match_graph;
-  std::unordered_map<uint32_t, uint8_t> vertex_flag;
-  for(uint32_t qi=0; qi<img_count; ++qi) {
-    for(uint32_t mj=qi+1; mj<img_count; ++mj) {
-      // check if the distance between query qi and match mj is 0
-      bool distance_is_zero = true;
-      for(uint32_t fi=0; fi<img_feature_count; ++fi) {
-        if( (features[qi*img_feature_count + fi] ^ features[mj*img_feature_count + fi]) != 0 ) {
-          distance_is_zero = false;
-          break;
-        }
+  // candidate pairs have similar aspect ratio and thumbnail
+  std::vector<std::pair<uint32_t, uint32_t> > candidates;
+  for(uint32_t i=0; i<thumbnails.size(); ++i) {
+    const fii_thumbnail &a = *thumbnails[i];
+    uint64_t dim_a = (((uint64_t) a.width) << 32) | a.height;
+    double aspect_a = ((double) a.width) / a.height;
+    fii_resized_keys(a, true, keys);
+    for(std::size_t ki=0; ki<keys.size(); ++ki) {
+      std::unordered_map<uint64_t, fii_thumbnails_of_dim>::const_iterator ti = thumbnails_of_key.find(keys[ki]);
+      if(ti == thumbnails_of_key.end()) {
+        continue;
       }
-      if(distance_is_zero) {
-        uint32_t qindex = filename_index_list.at(qi);
-        uint32_t mindex = filename_index_list.at(mj);
-        // insert undirected edge between query and match
-        if(match_graph.find(qindex) == match_graph.end()) {
-          match_graph[qindex] = std::set<uint32_t>();
-        }
-        if(match_graph.find(mindex) == match_graph.end()) {
-          match_graph[mindex] = std::set<uint32_t>();
+      fii_thumbnails_of_dim::const_iterator di;
+      for(di=ti->second.begin(); di!=ti->second.end(); ++di) {
+        if(di->first == dim_a) {
+          continue; // same dimension images are compared using their features
         }
-        match_graph[qindex].insert(mindex);
-        match_graph[mindex].insert(qindex);
-        // maintain vertex list
-        if(vertex_flag.count(qindex) == 0) {
-          vertex_flag[qindex] = 0;
+        const fii_thumbnail &b0 = *thumbnails[ di->second[0] ];
+        double aspect_b = ((double) b0.width) / b0.height;
+        if(std::fabs(aspect_a - aspect_b) > FII_RESIZED_MAX_ASPECT_DIFF * std::min(aspect_a, aspect_b)) {
+          continue;
         }
-        if(vertex_flag.count(mindex) == 0) {
-          vertex_flag[mindex] = 0;
+        for(std::size_t tj=0; tj<di->second.size(); ++tj) {
+          uint32_t j = di->second[tj];
+          const fii_thumbnail &b = *thumbnails[j];
+          if(findex_offset && ((a.findex < findex_offset) == (b.findex < findex_offset))) {
+            continue;
+          }
+          uint32_t diff = 0;
+          for(uint32_t vi=0; vi<FII_THUMBNAIL_VALUE_COUNT; ++vi) {
+            diff += std::abs(((int) a.value[vi]) - ((int) b.value[vi]));
+          }
+          if(diff > FII_RESIZED_MAX_THUMBNAIL_DIFF * FII_THUMBNAIL_VALUE_COUNT) {
+            continue;
+          }
+          candidates.push_back(std::make_pair(std::min(i, j), std::max(i, j)));
         }
       }
     }
   }
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
 
-  // perform depth first search to find all the connected components
-  std::unordered_map<uint32_t, std::set<uint32_t> >::const_iterator itr;
-  for(itr=match_graph.begin(); itr!=match_graph.end(); ++itr) {
-    uint32_t query_id = itr->first;
-
-    if(vertex_flag[query_id] == 1) {
-      continue; // discard already visited nodes
+  // the larger image is resampled to the dimension of the smaller image, the
+  // candidate pairs are verified in batches such that an image is decoded
+  // only once for all its pairs in a batch and its pixels are retained (within
+  // the budget of the pixel cache) for its pairs in later batches
+  bool is_dihedral = options.count("flip-rotate") != 0;
+  std::vector<uint8_t> is_resized(candidates.size(), 0);
+  std::unordered_map<uint32_t, uint32_t> remaining_pair_count;
+  for(std::size_t ci=0; ci<candidates.size(); ++ci) {
+    remaining_pair_count[ candidates[ci].first ] += 1;
+    remaining_pair_count[ candidates[ci].second ] += 1;
+  }
+  fii_pixel_cache cache;
+  fii_pixel_cache_init(cache, fii_pixel_cache_size(options));
+  for(std::size_t batch_start=0; batch_start<candidates.size(); batch_start+=FII_RESIZED_PAIR_BATCH_SIZE) {
+    std::size_t batch_end = std::min(batch_start + FII_RESIZED_PAIR_BATCH_SIZE, candidates.size());
+    std::vector<uint32_t> decode_list;
+    std::unordered_set<uint32_t> is_listed;
+    for(std::size_t ci=batch_start; ci<batch_end; ++ci) {
+      uint32_t pair[2] = { candidates[ci].first, candidates[ci].second };
+      for(int k=0; k<2; ++k) {
+        if(!is_listed.count(pair[k]) && !fii_pixel_cache_contains(cache, pair[k])) {
+          is_listed.insert(pair[k]);
+          decode_list.push_back(pair[k]);
+        }
+      }
+    }
+    std::vector<std::vector<uint8_t> > decoded_pixels(decode_list.size());
+#pragma omp parallel for schedule(dynamic)
+    for(std::size_t di=0; di<decode_list.size(); ++di) {
+      const fii_thumbnail *img = thumbnails[ decode_list[di] ];
+      if(findex_offset && img->findex >= findex_offset) {
+        fii_load_img_pixels(filename_prefix2 + filename_list2.at(img->findex - findex_offset), decoded_pixels[di], is_dihedral);
+      } else {
+        fii_load_img_pixels(filename_prefix1 + filename_list1.at(img->findex), decoded_pixels[di], is_dihedral);
+      }
     }
-    std::set<uint32_t> match_id_list(itr->second);
-    std::set<uint32_t> visited_nodes;
-    std::set<uint32_t>::const_iterator mitr = match_id_list.begin();
-    for(; mitr != match_id_list.end(); ++mitr) {
-      uint32_t match_id = *mitr;
-      if(vertex_flag[match_id] == 1) {
-        continue; // discard already visited nodes
+    // pixels that do not fit in the cache are only used by this batch
+    std::unordered_map<uint32_t, std::vector<uint8_t> > batch_pixels;
+    for(std::size_t di=0; di<decode_list.size(); ++di) {
+      if(!fii_pixel_cache_put(cache, decode_list[di], decoded_pixels[di], remaining_pair_count[ decode_list[di] ])) {
+        batch_pixels[ decode_list[di] ].swap(decoded_pixels[di]);
       }
-      vertex_flag[match_id] = 1;
-      visited_nodes.insert(match_id);
-      fii_depth_first_search(match_graph, vertex_flag, match_id, visited_nodes);
     }
-    if(visited_nodes.size() == 0) {
-      continue; // discard empty components
+    std::vector<std::vector<uint8_t> >().swap(decoded_pixels);
+
+#pragma omp parallel for schedule(dynamic)
+    for(std::size_t ci=batch_start; ci<batch_end; ++ci) {
+      uint32_t small_index = candidates[ci].first;
+      uint32_t large_index = candidates[ci].second;
+      if(((uint64_t) thumbnails[small_index]->width) * thumbnails[small_index]->height >
+         ((uint64_t) thumbnails[large_index]->width) * thumbnails[large_index]->height) {
+        std::swap(small_index, large_index);
+      }
+      const fii_thumbnail *small = thumbnails[small_index];
+      const fii_thumbnail *large = thumbnails[large_index];
+      std::vector<uint8_t> pixels[2];
+      uint32_t img_index[2] = { small_index, large_index };
+      for(int k=0; k<2; ++k) {
+        std::unordered_map<uint32_t, std::vector<uint8_t> >::const_iterator bi = batch_pixels.find(img_index[k]);
+        if(bi != batch_pixels.end()) {
+          pixels[k] = bi->second;
+        } else if(!fii_pixel_cache_take(cache, img_index[k], pixels[k])) {
+          // evicted for an image with more pending pairs
+          const fii_thumbnail *img = thumbnails[ img_index[k] ];
+          if(findex_offset && img->findex >= findex_offset) {
+            fii_load_img_pixels(filename_prefix2 + filename_list2.at(img->findex - findex_offset), pixels[k], is_dihedral);
+          } else {
+            fii_load_img_pixels(filename_prefix1 + filename_list1.at(img->findex), pixels[k], is_dihedral);
+          }
+        }
+      }
+      if(pixels[1].size() != ((uint64_t) large->width) * large->height * large->nchannel ||
+         pixels[0].size() != ((uint64_t) small->width) * small->height * small->nchannel) {
+        continue; // malformed image
+      }
+      std::vector<uint8_t> resized;
+      fii_resize_img_area(pixels[1], large->width, large->height, large->nchannel,
+                          small->width, small->height, resized);
+      uint64_t diff = 0;
+      for(std::size_t vi=0; vi<resized.size(); ++vi) {
+        diff += std::abs(((int) resized[vi]) - ((int) pixels[0][vi]));
+      }
+      is_resized[ci] = diff <= FII_RESIZED_MAX_MEAN_DIFF * resized.size();
+    }
+    for(std::size_t ci=batch_start; ci<batch_end; ++ci) {
+      remaining_pair_count[ candidates[ci].first ] -= 1;
+      remaining_pair_count[ candidates[ci].second ] -= 1;
+    }
+  }
+
+  fii_union_find image_sets;
+  fii_union_find_init(image_sets, thumbnails.size());
+  for(std::size_t ci=0; ci<candidates.size(); ++ci) {
+    if(is_resized[ci]) {
+      fii_union_find_merge(image_sets, candidates[ci].first, candidates[ci].second);
     }
-    //visited_nodes.push_back(query_id); // add query node
-    image_groups.push_back(visited_nodes);
   }
+  std::vector<uint32_t> node_findex(thumbnails.size());
+  for(uint32_t i=0; i<thumbnails.size(); ++i) {
+    node_findex[i] = thumbnails[i]->findex;
+  }
+  fii_union_find_groups(image_sets, node_findex, resized_groups);
+  std::sort(resized_groups.begin(), resized_groups.end(),
+            [](const std::set<uint32_t> &a, const std::set<uint32_t> &b) {
+              return *a.begin() < *b.begin();
+            });
 }
 
+// Find groups of images whose perceptual hash differ in at most
+// --hamming-radius bits using multi-index hashing (see FII_PHASH_SIZE).
+// Images that are already in the same group of identical images are not
+// reported again. If findex_offset is not 0, only the near identical images
+// between the two lists (i.e. findex < findex_offset and findex >=
+// findex_offset) are found.
+void fii_find_near_identical_img(const std::unordered_map<std::string, fii_img_signatures> &signatures,
+                                 const std::unordered_map<std::string, std::string> &options,
+                                 const uint32_t findex_offset,
+                                 const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
+                                 std::vector<std::set<uint32_t> > &near_groups) {
+  near_groups.clear();
+  uint32_t radius = fii_hamming_radius(options);
 
-void fii_depth_first_search(const std::unordered_map<uint32_t, std::set<uint32_t> > &match_graph,
-                            std::unordered_map<uint32_t, uint8_t> &vertex_flag,
-                            uint32_t vertex,
-                            std::set<uint32_t> &visited_nodes) {
-  if(match_graph.count(vertex) == 0) {
-    return; // this vertex is not connected to any other nodes
+  std::vector<fii_phash> phash_list;
+  std::unordered_map<std::string, fii_img_signatures>::const_iterator it;
+  for(it=signatures.begin(); it!=signatures.end(); ++it) {
+    phash_list.insert(phash_list.end(), it->second.phash.begin(), it->second.phash.end());
+  }
+  uint32_t n = phash_list.size();
+  if(n < 2) {
+    return;
   }
 
-  std::set<uint32_t> match_file_id_list( match_graph.at(vertex) );
-  std::set<uint32_t>::const_iterator mitr = match_file_id_list.begin();
-  for(; mitr != match_file_id_list.end(); ++mitr) {
-    uint32_t visited_vertex = *mitr;
-    if(vertex_flag[visited_vertex] == 1) {
-      continue; // discard visited vertices
+  // identical images are not near identical
+  std::unordered_map<uint32_t, uint32_t> identical_group_of_findex;
+  uint32_t identical_group_id = 0;
+  std::unordered_map<std::string, std::vector<std::set<uint32_t> > >::const_iterator gi;
+  for(gi=image_groups.begin(); gi!=image_groups.end(); ++gi) {
+    for(std::size_t group_id=0; group_id<gi->second.size(); ++group_id) {
+      std::set<uint32_t>::const_iterator si;
+      for(si=gi->second[group_id].begin(); si!=gi->second[group_id].end(); ++si) {
+        identical_group_of_findex[*si] = identical_group_id;
+      }
+      identical_group_id += 1;
+    }
+  }
+  std::vector<int64_t> identical_group(n, -1);
+  for(uint32_t i=0; i<n; ++i) {
+    std::unordered_map<uint32_t, uint32_t>::const_iterator fi = identical_group_of_findex.find(phash_list[i].findex);
+    if(fi != identical_group_of_findex.end()) {
+      identical_group[i] = fi->second;
     }
-    vertex_flag[visited_vertex] = 1;
-    visited_nodes.insert(visited_vertex);
-    fii_depth_first_search(match_graph, vertex_flag, visited_vertex, visited_nodes);
   }
-}
 
-std::string fii_img_dim_id(const int &width,
-                           const int &height,
-                           const int &nchannel) {
-  std::ostringstream ss;
-  ss << width << "x" << height << "x" << nchannel;
-  return ss.str();
+  // each table contains the sorted (substring, index) of all hashes, the
+  // substring length grows with log2(n) so that each table lookup returns
+  // only a few hashes
+  uint32_t substring_bits = (uint32_t) std::lround(std::log2((double) n));
+  substring_bits = std::max(FII_PHASH_MIN_SUBSTRING_BITS, std::min(FII_PHASH_MAX_SUBSTRING_BITS, substring_bits));
+  uint32_t table_count = (64 + substring_bits - 1) / substring_bits;
+  uint32_t sub_radius = radius / table_count;
+  std::vector<uint32_t> table_shift(table_count);
+  std::vector<uint64_t> table_mask(table_count);
+  std::vector<std::vector<std::pair<uint64_t, uint32_t> > > tables(table_count);
+  for(uint32_t t=0; t<table_count; ++t) {
+    table_shift[t] = t * substring_bits;
+    uint32_t bits = std::min(substring_bits, 64 - table_shift[t]);
+    table_mask[t] = (bits == 64) ? ~((uint64_t) 0) : ((((uint64_t) 1) << bits) - 1);
+    tables[t].resize(n);
+    for(uint32_t i=0; i<n; ++i) {
+      tables[t][i] = std::make_pair((phash_list[i].hash >> table_shift[t]) & table_mask[t], i);
+    }
+    std::sort(tables[t].begin(), tables[t].end());
+  }
+
+  // all substrings within sub_radius of a substring are obtained by flipping
+  // the bits of these masks (generated in increasing order of flipped bits)
+  std::vector<std::vector<uint64_t> > flip_masks(table_count);
+  uint64_t probe_count = 0;
+  for(uint32_t t=0; t<table_count; ++t) {
+    uint32_t bits = __builtin_popcountll(table_mask[t]);
+    std::vector<uint64_t> &masks = flip_masks[t];
+    masks.push_back(0);
+    std::size_t level_begin = 0;
+    for(uint32_t level=0; level<sub_radius; ++level) {
+      std::size_t level_end = masks.size();
+      for(std::size_t mi=level_begin; mi<level_end; ++mi) {
+        // flip only the bits above the highest flipped bit to avoid duplicates
+        uint32_t first_bit = masks[mi] ? (64 - __builtin_clzll(masks[mi])) : 0;
+        for(uint32_t b=first_bit; b<bits; ++b) {
+          masks.push_back(masks[mi] | (((uint64_t) 1) << b));
+        }
+      }
+      level_begin = level_end;
+    }
+    probe_count += masks.size();
+  }
+  // for a large radius, comparing with all hashes is cheaper than the lookups
+  bool is_linear_scan = (probe_count * std::log2((double) n)) > n;
+
+  fii_union_find image_sets;
+  fii_union_find_init(image_sets, n);
+  auto merge_if_near = [&](const uint32_t i, const uint32_t j) {
+    if(((uint32_t) __builtin_popcountll(phash_list[i].hash ^ phash_list[j].hash)) > radius) {
+      return;
+    }
+    if(findex_offset &&
+       ((phash_list[i].findex < findex_offset) == (phash_list[j].findex < findex_offset))) {
+      return;
+    }
+    if(identical_group[i] != -1 && identical_group[i] == identical_group[j]) {
+      return;
+    }
+    fii_union_find_merge(image_sets, i, j);
+  };
+#pragma omp parallel for schedule(dynamic)
+  for(uint32_t i=0; i<n; ++i) {
+    uint64_t hash = phash_list[i].hash;
+    if(is_linear_scan) {
+      for(uint32_t j=i+1; j<n; ++j) {
+        merge_if_near(i, j);
+      }
+      continue;
+    }
+    for(uint32_t t=0; t<table_count; ++t) {
+      uint64_t substring = (hash >> table_shift[t]) & table_mask[t];
+      for(std::size_t mi=0; mi<flip_masks[t].size(); ++mi) {
+        std::pair<std::vector<std::pair<uint64_t, uint32_t> >::const_iterator,
+                  std::vector<std::pair<uint64_t, uint32_t> >::const_iterator> range;
+        range = std::equal_range(tables[t].begin(), tables[t].end(),
+                                 std::make_pair(substring ^ flip_masks[t][mi], (uint32_t) 0),
+                                 [](const std::pair<uint64_t, uint32_t> &a,
+                                    const std::pair<uint64_t, uint32_t> &b) {
+                                   return a.first < b.first;
+                                 });
+        for(; range.first!=range.second; ++range.first) {
+          uint32_t j = range.first->second;
+          if(j <= i) {
+            continue;
+          }
+          uint64_t other = phash_list[j].hash;
+          // the pair was already found using one of the previous tables
+          bool is_found = false;
+          for(uint32_t pt=0; pt<t; ++pt) {
+            uint64_t diff = ((hash ^ other) >> table_shift[pt]) & table_mask[pt];
+            if(((uint32_t) __builtin_popcountll(diff)) <= sub_radius) {
+              is_found = true;
+              break;
+            }
+          }
+          if(!is_found) {
+            merge_if_near(i, j);
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<uint32_t> node_findex(n);
+  for(uint32_t i=0; i<n; ++i) {
+    node_findex[i] = phash_list[i].findex;
+  }
+  fii_union_find_groups(image_sets, node_findex, near_groups);
+  std::sort(near_groups.begin(), near_groups.end(),
+            [](const std::set<uint32_t> &a, const std::set<uint32_t> &b) {
+              return *a.begin() < *b.begin();
+            });
 }
 
 bool fii_compare_bucket_by_value(std::pair<std::string, uint32_t>& a,
@@ -375,7 +2951,8 @@ void fii_group_by_img_dimension(const std::string check_dir,
                                 std::unordered_map<std::string, std::vector<uint32_t> > &buckets_of_img_index,
                                 std::unordered_map<std::string, std::vector<uint32_t> > &bucket_dim_list,
                                 std::vector<std::string> &sorted_bucket_id_list,
-                                bool verbose=true) {
+                                bool verbose=true,
+                                bool merge_rotated_dim=false) {
   uint32_t t0, t1; // for recording elapsed time
   if(verbose) {
     std::cout << "Processing " << check_dir << std::endl;
@@ -383,7 +2960,8 @@ void fii_group_by_img_dimension(const std::string check_dir,
   t0 = fii::getmillisecs();
   uint32_t discarded_file_count;
   std::cout << "  collecting filenames : " << std::flush;
-  fii::fs_list_img_files(check_dir, filename_list, discarded_file_count);
+  std::vector<fii::fs_inode> inode_list;
+  fii::fs_list_img_files(check_dir, filename_list, inode_list, discarded_file_count);
   t1 = fii::getmillisecs();
   if(verbose) {
     std::cout << "found " << filename_list.size()
@@ -407,6 +2985,20 @@ void fii_group_by_img_dimension(const std::string check_dir,
   std::vector<int> filename_height_list(filename_list.size());
   std::vector<int> filename_nchannel_list(filename_list.size());
 
+  // header of a file reached through more than one path (e.g. hardlinks) is
+  // parsed only once
+  std::vector<uint32_t> first_link(filename_list.size());
+  std::map<fii::fs_inode, uint32_t> first_link_of_inode;
+  for(uint32_t i=0; i<filename_list.size(); ++i) {
+    std::map<fii::fs_inode, uint32_t>::const_iterator li = first_link_of_inode.find(inode_list[i]);
+    if(li == first_link_of_inode.end()) {
+      first_link_of_inode[ inode_list[i] ] = i;
+      first_link[i] = i;
+    } else {
+      first_link[i] = li->second;
+    }
+  }
+
 #pragma omp parallel
   {
     int nt = omp_get_num_threads();
@@ -416,13 +3008,33 @@ void fii_group_by_img_dimension(const std::string check_dir,
     uint32_t fi0 = (filename_list.size() * rank) / nt;
     uint32_t fi1 = (filename_list.size() * (rank + 1)) / nt;
     for(uint32_t i=fi0; i<fi1; ++i) {
+      if(first_link[i] != i) {
+        continue;
+      }
       std::string file_path = check_dir + "/" + filename_list[i];
+      bool is_complete;
       fii_image_size(file_path.c_str(),
                      &filename_width_list[i],
                      &filename_height_list[i],
-                     &filename_nchannel_list[i]);
+                     &filename_nchannel_list[i],
+                     &is_complete);
+      if(filename_width_list[i] && !is_complete) {
+        // truncated images are malformed and are not decoded
+        filename_width_list[i] = 0;
+        filename_height_list[i] = 0;
+        filename_nchannel_list[i] = 0;
+      }
     }
   } // end of omp parallel
+  for(uint32_t i=0; i<filename_list.size(); ++i) {
+    filename_width_list[i] = filename_width_list[ first_link[i] ];
+    filename_height_list[i] = filename_height_list[ first_link[i] ];
+    filename_nchannel_list[i] = filename_nchannel_list[ first_link[i] ];
+    if(merge_rotated_dim && filename_width_list[i] < filename_height_list[i]) {
+      // rotated images (e.g. 480x640x3 and 640x480x3) share a bucket
+      std::swap(filename_width_list[i], filename_height_list[i]);
+    }
+  }
 
   buckets_of_img_index.clear();
   std::unordered_map<std::string, uint32_t> buckets_img_count;
@@ -493,6 +3105,44 @@ void fii_group_by_img_dimension(const std::string check_dir,
   }
 }
 
+// Images of a folder nested inside another folder (e.g. CHECK_DIR1/subdir/)
+// are selected from the images of the outer folder, that have already been
+// grouped by their dimension, to avoid crawling the nested folder again.
+// nested_prefix is the path of nested folder relative to the outer folder.
+void fii_group_nested_folder_by_img_dimension(const std::vector<std::string> &outer_filename_list,
+                                              const std::unordered_map<std::string, std::vector<uint32_t> > &outer_buckets_of_img_index,
+                                              const std::unordered_map<std::string, std::vector<uint32_t> > &outer_bucket_dim_list,
+                                              const std::string nested_prefix,
+                                              std::vector<std::string> &filename_list,
+                                              std::unordered_map<std::string, std::vector<uint32_t> > &buckets_of_img_index,
+                                              std::unordered_map<std::string, std::vector<uint32_t> > &bucket_dim_list) {
+  filename_list.clear();
+  buckets_of_img_index.clear();
+  std::vector<uint32_t> nested_findex(outer_filename_list.size(), UINT32_MAX);
+  for(uint32_t i=0; i<outer_filename_list.size(); ++i) {
+    const std::string &filename = outer_filename_list[i];
+    if(filename.compare(0, nested_prefix.size(), nested_prefix) == 0) {
+      nested_findex[i] = filename_list.size();
+      filename_list.push_back(filename.substr(nested_prefix.size()));
+    }
+  }
+
+  std::unordered_map<std::string, std::vector<uint32_t> >::const_iterator bi;
+  for(bi=outer_buckets_of_img_index.begin(); bi!=outer_buckets_of_img_index.end(); ++bi) {
+    for(std::size_t i=0; i<bi->second.size(); ++i) {
+      uint32_t findex = nested_findex[ bi->second[i] ];
+      if(findex != UINT32_MAX) {
+        buckets_of_img_index[bi->first].push_back(findex);
+      }
+    }
+    if(buckets_of_img_index.count(bi->first)) {
+      bucket_dim_list[bi->first] = outer_bucket_dim_list.at(bi->first);
+    }
+  }
+  std::cout << "  found " << filename_list.size() << " images in nested folder "
+            << nested_prefix << std::endl;
+}
+
 void fii_save_img_dimension_histogram(std::unordered_map<std::string, std::vector<uint32_t> > &buckets_of_img_index,
                                       std::vector<std::string> &bucket_id_list,
                                       std::string hist_fn) {
@@ -505,4 +3155,353 @@ void fii_save_img_dimension_histogram(std::unordered_map<std::string, std::vecto
   hist.close();
 }
 
+// find images that are exact crops of a larger image (see fii_crop.h) and
+// save them to csv_fn, img_name[findex] is the name of an image
+void fii_find_img_crops(const std::vector<fii_crop_file> &files,
+                        const std::unordered_map<std::string, fii_img_signatures> &signatures,
+                        const std::vector<uint32_t> &folder_findex_offset,
+                        const std::vector<std::string> &img_name,
+                        const std::string csv_fn) {
+  uint32_t t0 = fii::getmillisecs();
+  std::cout << "Finding images that are crops of larger images" << std::endl;
+  // anchors of all images were computed while finding identical images
+  std::vector<fii_crop_img> crops;
+  std::unordered_map<std::string, fii_img_signatures>::const_iterator it;
+  for(it=signatures.begin(); it!=signatures.end(); ++it) {
+    crops.insert(crops.end(), it->second.crop.begin(), it->second.crop.end());
+  }
+  fii_crop_index index;
+  fii_build_crop_index(crops, index);
+  std::vector<fii_crop_match> matches;
+  fii_find_crops(files, index, folder_findex_offset, matches);
+  for(std::size_t i=0; i<matches.size(); ++i) {
+    const fii_crop_match &match = matches[i];
+    std::cout << "  " << img_name.at(match.crop_findex) << " is in "
+              << img_name.at(match.img_findex) << " at ("
+              << match.x << "," << match.y << ")" << std::endl;
+  }
+  uint32_t t1 = fii::getmillisecs();
+  std::cout << "Found " << matches.size() << " crops of larger images using "
+            << index.crops.size() << " indexed images ("
+            << (((double)(t1 - t0)) / 1000.0) << "s)" << std::endl;
+  if(matches.size() && fii_crop_export_csv(matches, img_name, csv_fn)) {
+    std::cout << "Crops saved to " << csv_fn << std::endl;
+  }
+}
+
+// Images of N folders are indexed by findex in the order of folders and
+// folder_img_count[k] is the number of images in k-th folder. An image file
+// present in more than one folder (i.e. nested folders) has the same file_id.
+// leakage[i][j] is the number of images in i-th folder that have an identical
+// copy (i.e. a different image file) in j-th folder.
+void fii_compute_leakage_matrix(const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
+                                const std::vector<uint32_t> &folder_img_count,
+                                const std::vector<uint32_t> &file_id,
+                                std::vector<std::vector<uint32_t> > &leakage) {
+  std::size_t folder_count = folder_img_count.size();
+  leakage.assign(folder_count, std::vector<uint32_t>(folder_count, 0));
+
+  std::vector<uint32_t> folder_findex_end(folder_count);
+  uint32_t findex_end = 0;
+  for(std::size_t k=0; k<folder_count; ++k) {
+    findex_end += folder_img_count[k];
+    folder_findex_end[k] = findex_end;
+  }
+
+  std::unordered_map<std::string, std::vector<std::set<uint32_t> > >::const_iterator bi;
+  for(bi=image_groups.begin(); bi!=image_groups.end(); ++bi) {
+    for(std::size_t group_id=0; group_id<bi->second.size(); ++group_id) {
+      // distinct image files of this group contained in each folder
+      std::vector<std::set<uint32_t> > folder_file_id(folder_count);
+      std::vector<std::pair<uint32_t, uint32_t> > member_folder_and_file;
+      std::set<uint32_t>::const_iterator si;
+      for(si=bi->second[group_id].begin(); si!=bi->second[group_id].end(); ++si) {
+        std::size_t k = std::upper_bound(folder_findex_end.begin(), folder_findex_end.end(), *si) - folder_findex_end.begin();
+        folder_file_id[k].insert(file_id[*si]);
+        member_folder_and_file.push_back(std::make_pair(k, file_id[*si]));
+      }
+      for(std::size_t mi=0; mi<member_folder_and_file.size(); ++mi) {
+        uint32_t i = member_folder_and_file[mi].first;
+        uint32_t member_file_id = member_folder_and_file[mi].second;
+        for(std::size_t j=0; j<folder_count; ++j) {
+          std::size_t other_file_count = folder_file_id[j].size() - folder_file_id[j].count(member_file_id);
+          if(other_file_count) {
+            leakage[i][j] += 1;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Find identical images between N folders (e.g. train, val and test subsets
+// of a dataset) or between a folder and the folders nested inside it. Images
+// of every folder are grouped by their dimension and the images of all
+// folders with the same dimension are searched together, hence every image
+// file is decoded only once. Images of CHECK_DIR1 (i.e. check_dir_list[0])
+// are already grouped by their dimension.
+void fii_find_identical_img_in_folders(const std::vector<std::string> &check_dir_list,
+                                       const std::vector<std::string> &canonical_dir_list,
+                                       const bool has_nested_dir,
+                                       const std::vector<std::string> &filename_list1,
+                                       const std::unordered_map<std::string, std::vector<uint32_t> > &buckets_of_img_index1,
+                                       const std::unordered_map<std::string, std::vector<uint32_t> > &bucket_img_dim_list1,
+                                       const std::string cache_dir1,
+                                       const std::unordered_map<std::string, std::string> &options,
+                                       const uint32_t tstart) {
+  if(options.count("match-gray") || options.count("find-resized") ||
+     options.count("near-identical") || options.count("dir2-filter")) {
+    std::cout << "--match-gray, --find-resized, --near-identical and --dir2-filter "
+              << "are ignored when comparing more than two folders or nested folders"
+              << std::endl;
+  }
+  bool merge_rotated_dim = options.count("flip-rotate") != 0;
+  std::vector<std::string> dir_name_list;
+  for(std::size_t k=0; k<check_dir_list.size(); ++k) {
+    dir_name_list.push_back(fii::fs_dirname(check_dir_list[k]));
+  }
+  std::size_t folder_count = check_dir_list.size();
+  std::vector<std::vector<std::string> > filename_lists(folder_count);
+  std::vector<std::unordered_map<std::string, std::vector<uint32_t> > > buckets_of_img_index_list(folder_count);
+  std::unordered_map<std::string, std::vector<uint32_t> > bucket_img_dim_list(bucket_img_dim_list1);
+  filename_lists[0] = filename_list1;
+  buckets_of_img_index_list[0] = buckets_of_img_index1;
+
+  // outer folders are crawled before the folders nested inside them
+  std::vector<std::size_t> crawl_order;
+  for(std::size_t k=1; k<folder_count; ++k) {
+    crawl_order.push_back(k);
+  }
+  std::stable_sort(crawl_order.begin(), crawl_order.end(),
+                   [&canonical_dir_list](const std::size_t a, const std::size_t b) {
+                     return canonical_dir_list[a].size() < canonical_dir_list[b].size();
+                   });
+  std::vector<bool> is_crawled(folder_count, false);
+  is_crawled[0] = true;
+  for(std::size_t oi=0; oi<crawl_order.size(); ++oi) {
+    std::size_t k = crawl_order[oi];
+    fii::create_cache_dir(check_dir_list[k]);
+    std::unordered_map<std::string, std::vector<uint32_t> > bucket_img_dim_listk;
+    std::size_t outer_folder = folder_count;
+    for(std::size_t j=0; j<folder_count; ++j) {
+      if(is_crawled[j] && canonical_dir_list[k].compare(0, canonical_dir_list[j].size(), canonical_dir_list[j]) == 0) {
+        outer_folder = j;
+        break;
+      }
+    }
+    if(outer_folder != folder_count) {
+      std::cout << "Processing " << check_dir_list[k] << std::endl;
+      fii_group_nested_folder_by_img_dimension(filename_lists[outer_folder],
+                                               buckets_of_img_index_list[outer_folder],
+                                               bucket_img_dim_list,
+                                               canonical_dir_list[k].substr(canonical_dir_list[outer_folder].size()),
+                                               filename_lists[k],
+                                               buckets_of_img_index_list[k],
+                                               bucket_img_dim_listk);
+    } else {
+      std::vector<std::string> bucket_id_list;
+      fii_group_by_img_dimension(check_dir_list[k],
+                                 filename_lists[k],
+                                 buckets_of_img_index_list[k],
+                                 bucket_img_dim_listk,
+                                 bucket_id_list,
+                                 true,
+                                 merge_rotated_dim);
+      is_crawled[k] = true;
+    }
+    bucket_img_dim_list.insert(bucket_img_dim_listk.begin(), bucket_img_dim_listk.end());
+  }
+
+  // findex of images in k-th folder starts after all images of previous
+  // folders and file path of every image is stored in a single list
+  std::vector<std::string> all_filename_list;
+  std::vector<uint32_t> folder_img_count;
+  std::vector<uint32_t> folder_findex_offset;
+  std::unordered_map<std::string, std::vector<uint32_t> > all_buckets_of_img_index;
+  std::unordered_map<std::string, uint32_t> bucket_folder_count;
+  // an image file contained in nested folders is compared only once (using
+  // the findex of its first occurrence) and its other occurrences (i.e.
+  // aliases) are added to the groups of identical images later
+  std::vector<uint32_t> file_id;
+  std::unordered_map<uint32_t, std::vector<uint32_t> > file_aliases;
+  std::unordered_map<std::string, uint32_t> file_id_of_canonical_path;
+  for(std::size_t k=0; k<check_dir_list.size(); ++k) {
+    uint32_t findex_offset = all_filename_list.size();
+    folder_findex_offset.push_back(findex_offset);
+    folder_img_count.push_back(filename_lists[k].size());
+    for(std::size_t i=0; i<filename_lists[k].size(); ++i) {
+      uint32_t findex = findex_offset + i;
+      all_filename_list.push_back(check_dir_list[k] + filename_lists[k][i]);
+      file_id.push_back(findex);
+      if(has_nested_dir) {
+        std::string canonical_path = canonical_dir_list[k] + filename_lists[k][i];
+        if(file_id_of_canonical_path.count(canonical_path)) {
+          file_id[findex] = file_id_of_canonical_path[canonical_path];
+          file_aliases[ file_id[findex] ].push_back(findex);
+        } else {
+          file_id_of_canonical_path[canonical_path] = findex;
+        }
+      }
+    }
+    std::unordered_map<std::string, std::vector<uint32_t> >::const_iterator bi;
+    for(bi=buckets_of_img_index_list[k].begin(); bi!=buckets_of_img_index_list[k].end(); ++bi) {
+      std::vector<uint32_t> &img_index = all_buckets_of_img_index[bi->first];
+      for(std::size_t i=0; i<bi->second.size(); ++i) {
+        uint32_t findex = findex_offset + bi->second[i];
+        if(file_id[findex] == findex) {
+          img_index.push_back(findex);
+        }
+      }
+      bucket_folder_count[bi->first] += 1;
+    }
+  }
+  std::unordered_map<std::string, uint32_t>().swap(file_id_of_canonical_path);
+
+  uint32_t identical_img_count = 0;
+  fii_img_name_fn img_name = fii_export_img_name_fn(filename_lists, check_dir_list);
+  std::unordered_map<std::string, std::vector<std::set<uint32_t> > > all_image_groups;
+  std::unordered_map<std::string, std::vector<std::set<uint32_t> > > image_groups;
+  fii_match_stats match_stats;
+  // crop anchors are the only signatures used when comparing N folders
+  std::unordered_map<std::string, fii_img_signatures> signatures;
+  bool has_signatures = options.count("find-crops");
+  std::unordered_map<std::string, std::vector<uint32_t> >::const_iterator bi;
+  for(bi=all_buckets_of_img_index.begin(); bi!=all_buckets_of_img_index.end(); ++bi) {
+    std::string bucket_id = bi->first;
+    if(bucket_id == "0x0x0") {
+      // indicates malformed image, discard
+      continue;
+    }
+
+    std::vector<std::set<uint32_t> > bucket_image_groups;
+    fii_find_identical_img(all_filename_list,
+                           bi->second,
+                           "",
+                           bucket_img_dim_list[bucket_id],
+                           options,
+                           bucket_image_groups,
+                           &match_stats,
+                           (has_signatures && bi->second.size() > 1) ? &signatures[bucket_id] : NULL);
+    if(bucket_image_groups.size() == 0) {
+      continue;
+    }
+    if(file_aliases.size()) {
+      for(std::size_t group_id=0; group_id!=bucket_image_groups.size(); ++group_id) {
+        std::set<uint32_t> group_members(bucket_image_groups[group_id]);
+        std::set<uint32_t>::const_iterator si;
+        for(si=group_members.begin(); si!=group_members.end(); ++si) {
+          if(file_aliases.count(*si)) {
+            bucket_image_groups[group_id].insert(file_aliases[*si].begin(), file_aliases[*si].end());
+          }
+        }
+      }
+    }
+    all_image_groups[bucket_id] = bucket_image_groups;
+    if(bucket_folder_count[bucket_id] < 2) {
+      continue;
+    }
+
+    // only the groups containing images from more than one folder are listed
+    bool is_first_group = true;
+    for(std::size_t group_id=0; group_id!=bucket_image_groups.size(); ++group_id) {
+      const std::set<uint32_t> &group_members = bucket_image_groups.at(group_id);
+      std::size_t first_folder = std::upper_bound(folder_findex_offset.begin(), folder_findex_offset.end(), *group_members.begin()) - folder_findex_offset.begin();
+      std::size_t last_folder = std::upper_bound(folder_findex_offset.begin(), folder_findex_offset.end(), *group_members.rbegin()) - folder_findex_offset.begin();
+      if(first_folder == last_folder) {
+        continue;
+      }
+      if(is_first_group) {
+        std::cout << bucket_id
+                  << " (" << bi->second.size() << " images)"
+                  << std::endl;
+        is_first_group = false;
+      }
+      std::vector<std::set<uint32_t> > &cross_groups = image_groups[bucket_id];
+      fii_show_img_group("", cross_groups.size(), group_members, img_name);
+      cross_groups.push_back(group_members);
+      identical_img_count += group_members.size() - 1;
+    }
+  }
+  std::cout << std::endl;
+  if(has_signatures) {
+    // a bucket containing a single image is not compared above
+    std::set<std::string> signature_bucket_id_list = fii_signature_bucket_id_list(bucket_img_dim_list,
+                                                                                  bucket_img_dim_list,
+                                                                                  signatures,
+                                                                                  options);
+    fii_compute_img_signatures(all_filename_list, "", 0,
+                               all_buckets_of_img_index, bucket_img_dim_list,
+                               signature_bucket_id_list, options, signatures);
+  }
+
+  // leakage between folders (e.g. train, val, test subsets of a dataset)
+  std::vector<std::vector<uint32_t> > leakage;
+  fii_compute_leakage_matrix(all_image_groups, folder_img_count, file_id, leakage);
+  std::cout << "Number of images in a folder (row) with identical copy in a folder (column)" << std::endl;
+  for(std::size_t i=0; i<check_dir_list.size(); ++i) {
+    std::cout << "  " << std::setw(16) << std::left << dir_name_list[i] << std::right;
+    for(std::size_t j=0; j<check_dir_list.size(); ++j) {
+      std::cout << std::setw(10) << leakage[i][j];
+    }
+    std::cout << std::endl;
+  }
+  std::cout << std::endl;
+
+  uint32_t tend = fii::getmillisecs();
+  double elapsed_sec = ((double)(tend - tstart)) / 1000.0;
+
+  double time_per_image = elapsed_sec / ((double) all_filename_list.size());
+  for(std::size_t k=0; k<check_dir_list.size(); ++k) {
+    if(buckets_of_img_index_list[k].count("0x0x0")) {
+      std::cout << "Discarded " << buckets_of_img_index_list[k]["0x0x0"].size()
+                << " malformed images in " << check_dir_list[k] << std::endl;
+    }
+  }
+  fii_show_undecodable_files(match_stats);
+  fii_show_file_copy_stats(match_stats);
+  if(options.count("check-all-pixels") || options.count("check-tiers") ||
+     options.count("max-pixel-diff") || options.count("max-diff-fraction")) {
+    fii_show_match_stats(match_stats);
+  }
+
+  std::cout << "Processed " << check_dir_list.size() << " folders with "
+            << all_filename_list.size() << " images in "
+            << elapsed_sec << "s (" << time_per_image << "s per image)."
+            << std::endl;
+  if(image_groups.size()) {
+    std::cout << "Found " << identical_img_count << " identical images."
+              << std::endl;
+  } else {
+    std::cout << "Identical images not found." << std::endl;
+  }
+  std::string export_dir = cache_dir1;
+  if(options.count("export")) {
+    export_dir = options.at("export");
+  }
+  fii_export_multi_all(image_groups, leakage, export_dir, filename_lists, check_dir_list);
+
+  if(options.count("find-crops")) {
+    std::vector<fii_crop_file> crop_files;
+    std::vector<std::string> img_name;
+    std::string prefix;
+    for(std::size_t k=0; k<check_dir_list.size(); ++k) {
+      fii_crop_add_files(filename_lists[k], check_dir_list[k], folder_findex_offset[k],
+                         buckets_of_img_index_list[k], crop_files);
+      for(std::size_t i=0; i<filename_lists[k].size(); ++i) {
+        img_name.push_back(dir_name_list[k] + "/" + filename_lists[k][i]);
+      }
+      prefix += (k ? "-" : "") + dir_name_list[k];
+    }
+    // an image contained in nested folders is searched only once
+    std::vector<fii_crop_file> unique_crop_files;
+    for(std::size_t i=0; i<crop_files.size(); ++i) {
+      if(file_id[ crop_files[i].findex ] == crop_files[i].findex) {
+        unique_crop_files.push_back(crop_files[i]);
+      }
+    }
+    fii_find_img_crops(unique_crop_files, signatures, folder_findex_offset, img_name,
+                       export_dir + prefix + "-crops.csv");
+  }
+}
+
 #endif
@@ -0,0 +1,222 @@
+/*
+  Bloom filter of the keys (i.e. hash of sparse features) of all images in
+  CHECK_DIR2 that have a certain image dimension. An image in CHECK_DIR1
+  whose key is not present in the filter cannot have an identical image in
+  CHECK_DIR2 and is rejected without decoding any image in CHECK_DIR2.
+
+  Bit positions are derived from the 64 bit key using double hashing. With
+  FII_BLOOM_FILTER_BITS_PER_KEY bits per key and FII_BLOOM_FILTER_NHASH bit
+  positions, less than 1% of absent keys are wrongly reported as present.
+
+  A saved filter is only valid for the CHECK_DIR2 images that were used to
+  build it. Each filter stores a fingerprint of the name, size and
+  modification time of these files and the filter is rebuilt when the
+  fingerprint of the current CHECK_DIR2 images does not match. The filter is
+  also rebuilt when the key (sparse features or coarse signature, of the
+  original or the canonical image) or the tolerance of the current search
+  differs from the one used to build it.
+
+  The key of every decoded image is saved along with the hash of its file
+  name, size and modification time. Therefore, only the CHECK_DIR2 images
+  whose key is also the key of an image in CHECK_DIR1 are decoded again.
+*/
+
+#ifndef FII_BLOOM_FILTER_H
+#define FII_BLOOM_FILTER_H
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fii_hash.h"
+
+const uint32_t FII_BLOOM_FILTER_BITS_PER_KEY = 10;
+const uint32_t FII_BLOOM_FILTER_NHASH = 7;
+const uint32_t FII_BLOOM_FILTER_FILE_MAGIC = 0x46494944; // "FIID"
+const uint32_t FII_BLOOM_FILTER_OLD_FILE_MAGIC = 0x46494943; // "FIIC"
+
+// key mode: keys are the hash of sparse features unless these flags are set
+const uint32_t FII_BLOOM_FILTER_KEY_COARSE = 1;   // hash of coarse signature
+const uint32_t FII_BLOOM_FILTER_KEY_DIHEDRAL = 2; // of the canonical image
+
+struct fii_bloom_filter {
+  uint32_t sparse_feature_count = 0; // number of feature values used as key
+  uint32_t key_count = 0;            // number of images added to the filter
+  uint32_t key_mode = 0;
+  uint32_t max_pixel_diff = 0;       // tolerance of the search
+  double max_diff_fraction = 0.0;
+  uint64_t fingerprint = 0;          // of the files whose keys were added
+  std::vector<uint64_t> bits;
+  std::unordered_map<uint64_t, uint64_t> file_keys; // file hash -> key
+};
+
+uint64_t fii_bloom_filter_word_count(const uint32_t key_count) {
+  uint64_t nbits = ((uint64_t) key_count) * FII_BLOOM_FILTER_BITS_PER_KEY;
+  return (nbits + 63) / 64 + 1;
+}
+
+void fii_bloom_filter_init(fii_bloom_filter &filter,
+                           const uint32_t key_count,
+                           const uint32_t sparse_feature_count,
+                           const uint32_t key_mode,
+                           const uint32_t max_pixel_diff,
+                           const double max_diff_fraction,
+                           const uint64_t fingerprint) {
+  filter.sparse_feature_count = sparse_feature_count;
+  filter.key_count = key_count;
+  filter.key_mode = key_mode;
+  filter.max_pixel_diff = max_pixel_diff;
+  filter.max_diff_fraction = max_diff_fraction;
+  filter.fingerprint = fingerprint;
+  filter.bits.assign(fii_bloom_filter_word_count(key_count), 0);
+  filter.file_keys.clear();
+}
+
+// can be called concurrently from multiple threads
+void fii_bloom_filter_add(fii_bloom_filter &filter,
+                          const uint64_t key) {
+  uint64_t nbits = filter.bits.size() * 64;
+  uint64_t h1 = key;
+  uint64_t h2 = fii_hash_fmix64(key) | 1;
+  for(uint32_t i=0; i<FII_BLOOM_FILTER_NHASH; ++i) {
+    uint64_t bit = (h1 + i * h2) % nbits;
+    __atomic_fetch_or(&filter.bits[bit / 64], ((uint64_t) 1) << (bit % 64), __ATOMIC_RELAXED);
+  }
+}
+
+bool fii_bloom_filter_contains(const fii_bloom_filter &filter,
+                               const uint64_t key) {
+  uint64_t nbits = filter.bits.size() * 64;
+  uint64_t h1 = key;
+  uint64_t h2 = fii_hash_fmix64(key) | 1;
+  for(uint32_t i=0; i<FII_BLOOM_FILTER_NHASH; ++i) {
+    uint64_t bit = (h1 + i * h2) % nbits;
+    if((filter.bits[bit / 64] & (((uint64_t) 1) << (bit % 64))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// filters of all image dimensions (e.g. 640x480x3) are saved in a binary file
+//
+bool fii_bloom_filter_save(const std::unordered_map<std::string, fii_bloom_filter> &filters,
+                           const std::string filename) {
+  std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+  if(!f) {
+    std::cout << "failed to save filter to " << filename << std::endl;
+    return false;
+  }
+  uint32_t filter_count = 0;
+  std::unordered_map<std::string, fii_bloom_filter>::const_iterator it;
+  for(it=filters.begin(); it!=filters.end(); ++it) {
+    if(it->second.bits.size()) {
+      filter_count += 1;
+    }
+  }
+  f.write((const char *) &FII_BLOOM_FILTER_FILE_MAGIC, sizeof(uint32_t));
+  f.write((const char *) &filter_count, sizeof(uint32_t));
+  for(it=filters.begin(); it!=filters.end(); ++it) {
+    const fii_bloom_filter &filter = it->second;
+    if(filter.bits.size() == 0) {
+      continue;
+    }
+    uint32_t id_size = it->first.size();
+    uint64_t word_count = filter.bits.size();
+    f.write((const char *) &id_size, sizeof(uint32_t));
+    f.write(it->first.data(), id_size);
+    f.write((const char *) &filter.sparse_feature_count, sizeof(uint32_t));
+    f.write((const char *) &filter.key_count, sizeof(uint32_t));
+    f.write((const char *) &filter.key_mode, sizeof(uint32_t));
+    f.write((const char *) &filter.max_pixel_diff, sizeof(uint32_t));
+    f.write((const char *) &filter.max_diff_fraction, sizeof(double));
+    f.write((const char *) &filter.fingerprint, sizeof(uint64_t));
+    f.write((const char *) &word_count, sizeof(uint64_t));
+    f.write((const char *) filter.bits.data(), word_count * sizeof(uint64_t));
+    uint64_t file_key_count = filter.file_keys.size();
+    f.write((const char *) &file_key_count, sizeof(uint64_t));
+    std::unordered_map<uint64_t, uint64_t>::const_iterator ki;
+    for(ki=filter.file_keys.begin(); ki!=filter.file_keys.end(); ++ki) {
+      uint64_t file_key[2] = { ki->first, ki->second };
+      f.write((const char *) file_key, sizeof(file_key));
+    }
+  }
+  return f.good();
+}
+
+// all sizes read from the file are validated against the number of bytes
+// that remain in the file before any memory is allocated
+bool fii_bloom_filter_load(const std::string filename,
+                           std::unordered_map<std::string, fii_bloom_filter> &filters) {
+  filters.clear();
+  std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+  if(!f) {
+    return false;
+  }
+  uint64_t file_size = f.tellg();
+  f.seekg(0);
+  uint32_t magic = 0;
+  uint32_t filter_count = 0;
+  f.read((char *) &magic, sizeof(uint32_t));
+  f.read((char *) &filter_count, sizeof(uint32_t));
+  if(f.good() && magic == FII_BLOOM_FILTER_OLD_FILE_MAGIC) {
+    std::cout << "filter file " << filename
+              << " was saved by an earlier version and will be rebuilt" << std::endl;
+    return false;
+  }
+  bool is_valid = f.good() && magic == FII_BLOOM_FILTER_FILE_MAGIC;
+  for(uint32_t i=0; is_valid && i<filter_count; ++i) {
+    uint32_t id_size = 0;
+    f.read((char *) &id_size, sizeof(uint32_t));
+    if(!f.good() || id_size > (file_size - f.tellg())) {
+      is_valid = false;
+      break;
+    }
+    std::string bucket_id(id_size, '\0');
+    f.read(&bucket_id[0], id_size);
+    fii_bloom_filter &filter = filters[bucket_id];
+    uint64_t word_count = 0;
+    f.read((char *) &filter.sparse_feature_count, sizeof(uint32_t));
+    f.read((char *) &filter.key_count, sizeof(uint32_t));
+    f.read((char *) &filter.key_mode, sizeof(uint32_t));
+    f.read((char *) &filter.max_pixel_diff, sizeof(uint32_t));
+    f.read((char *) &filter.max_diff_fraction, sizeof(double));
+    f.read((char *) &filter.fingerprint, sizeof(uint64_t));
+    f.read((char *) &word_count, sizeof(uint64_t));
+    if(!f.good() ||
+       word_count != fii_bloom_filter_word_count(filter.key_count) ||
+       word_count > (file_size - f.tellg()) / sizeof(uint64_t)) {
+      is_valid = false;
+      break;
+    }
+    filter.bits.resize(word_count);
+    f.read((char *) filter.bits.data(), word_count * sizeof(uint64_t));
+    uint64_t file_key_count = 0;
+    f.read((char *) &file_key_count, sizeof(uint64_t));
+    if(!f.good() ||
+       file_key_count > filter.key_count ||
+       file_key_count > (file_size - f.tellg()) / (2 * sizeof(uint64_t))) {
+      is_valid = false;
+      break;
+    }
+    filter.file_keys.reserve(file_key_count);
+    for(uint64_t k=0; k<file_key_count; ++k) {
+      uint64_t file_key[2] = {0, 0};
+      f.read((char *) file_key, sizeof(file_key));
+      filter.file_keys[file_key[0]] = file_key[1];
+    }
+    is_valid = f.good();
+  }
+  if(!is_valid) {
+    std::cout << "malformed filter file " << filename << std::endl;
+    filters.clear();
+    return false;
+  }
+  return true;
+}
+
+#endif
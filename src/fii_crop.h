@@ -0,0 +1,313 @@
+/*
+  Find images whose pixel values appear verbatim inside a larger image (i.e.
+  an exact crop) using an index of row windows instead of sliding every image
+  over every other image.
+
+  Every image is indexed by a single anchor: the polynomial hash of the first
+  FII_CROP_WINDOW_SIZE pixels wide window (in row major order) whose pixels
+  are not all equal. The anchor (see fii_crop_img) is computed while an image
+  is decoded to find identical images. Every image that is large enough to
+  contain an indexed image is then decoded once more and the rolling hash of
+  the window at every pixel location of every row is looked up in the index.
+  A hit gives the location of a candidate crop which is verified using the
+  polynomial hash and then the 128 bit hash of all its pixel values.
+  Therefore, the cost of the search grows with the number of pixels and not
+  with the number of pairs of images.
+*/
+
+#ifndef FII_CROP_H
+#define FII_CROP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fii_hash.h"
+
+// crops smaller than FII_CROP_WINDOW_SIZE pixels in width or height, and
+// crops with all pixels having same value, are not indexed
+const uint32_t FII_CROP_WINDOW_SIZE = 16;
+const uint64_t FII_CROP_HASH_BASE = 0x100000001b3ULL;
+// a bit array (indexed by the hash of anchor) avoids most of the index lookups
+const uint32_t FII_CROP_FILTER_BITS_LOG2 = 24;
+
+struct fii_crop_file {
+  uint32_t findex;
+  std::string path;
+};
+
+struct fii_crop_img {
+  uint32_t findex;
+  uint32_t width;
+  uint32_t height;
+  uint32_t nchannel;
+  uint32_t anchor_x;           // location of the anchor window
+  uint32_t anchor_y;
+  uint64_t anchor_hash;        // polynomial hash of the anchor window
+  uint64_t hash;               // polynomial hash of all pixel values
+  uint64_t content_hash[2];    // 128 bit hash of all pixel values
+};
+
+// an indexed image is stored in the feature row as a flag followed by its
+// fii_crop_img
+const uint32_t FII_CROP_SIGNATURE_SIZE = 1 + sizeof(fii_crop_img);
+
+struct fii_crop_index {
+  std::vector<fii_crop_img> crops;
+  std::unordered_map<uint64_t, std::vector<uint32_t> > crops_of_anchor;
+  std::vector<uint64_t> anchor_filter;
+  uint32_t min_width = 0;
+  uint32_t min_height = 0;
+};
+
+struct fii_crop_match {
+  uint32_t crop_findex;
+  uint32_t img_findex;
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+};
+
+// polynomial hash of a w x h region (in row major order) with stride bytes
+// per row, a window is hashed using height=1
+uint64_t fii_crop_region_hash(const uint8_t *data,
+                              const uint64_t w,
+                              const uint64_t h,
+                              const uint64_t stride) {
+  uint64_t hash = 0;
+  for(uint64_t y=0; y<h; ++y) {
+    const uint8_t *row = data + y * stride;
+    for(uint64_t i=0; i<w; ++i) {
+      hash = hash * FII_CROP_HASH_BASE + row[i];
+    }
+  }
+  return hash;
+}
+
+inline uint64_t fii_crop_filter_bit(const uint64_t anchor_hash) {
+  return fii_hash_fmix64(anchor_hash) >> (64 - FII_CROP_FILTER_BITS_LOG2);
+}
+
+void fii_crop_add_files(const std::vector<std::string> &filename_list,
+                        const std::string filename_prefix,
+                        const uint32_t findex_offset,
+                        const std::unordered_map<std::string, std::vector<uint32_t> > &buckets_of_img_index,
+                        std::vector<fii_crop_file> &files) {
+  std::unordered_map<std::string, std::vector<uint32_t> >::const_iterator bi;
+  for(bi=buckets_of_img_index.begin(); bi!=buckets_of_img_index.end(); ++bi) {
+    if(bi->first == "0x0x0") {
+      continue; // malformed images
+    }
+    for(std::size_t i=0; i<bi->second.size(); ++i) {
+      fii_crop_file file;
+      file.findex = findex_offset + bi->second[i];
+      file.path = filename_prefix + filename_list.at(bi->second[i]);
+      files.push_back(file);
+    }
+  }
+  std::sort(files.begin(), files.end(),
+            [](const fii_crop_file &a, const fii_crop_file &b) {
+              return a.findex < b.findex;
+            });
+}
+
+// returns false if the image cannot be indexed (too small or uniform)
+bool fii_crop_compute_anchor(const uint8_t *pixels,
+                             const uint32_t width,
+                             const uint32_t height,
+                             const uint32_t nchannel,
+                             fii_crop_img &crop) {
+  if(width < FII_CROP_WINDOW_SIZE || height < FII_CROP_WINDOW_SIZE) {
+    return false;
+  }
+  uint64_t stride = ((uint64_t) width) * nchannel;
+  uint64_t window_size = FII_CROP_WINDOW_SIZE * nchannel;
+  for(uint32_t y=0; y<height; ++y) {
+    for(uint32_t x=0; x + FII_CROP_WINDOW_SIZE <= width; x+=FII_CROP_WINDOW_SIZE) {
+      const uint8_t *window = pixels + y * stride + x * nchannel;
+      bool is_uniform = true;
+      for(uint64_t i=nchannel; i<window_size && is_uniform; ++i) {
+        is_uniform = window[i] == window[i % nchannel];
+      }
+      if(!is_uniform) {
+        crop.width = width;
+        crop.height = height;
+        crop.nchannel = nchannel;
+        crop.anchor_x = x;
+        crop.anchor_y = y;
+        crop.anchor_hash = fii_crop_region_hash(window, window_size, 1, stride);
+        crop.hash = fii_crop_region_hash(pixels, stride, height, stride);
+        fii_hash128(pixels, stride * height, 0, crop.content_hash);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void fii_build_crop_index(const std::vector<fii_crop_img> &crops,
+                          fii_crop_index &index) {
+  index.crops = crops;
+  std::sort(index.crops.begin(), index.crops.end(),
+            [](const fii_crop_img &a, const fii_crop_img &b) {
+              return a.findex < b.findex;
+            });
+  index.crops_of_anchor.clear();
+  index.anchor_filter.assign(((uint64_t) 1 << FII_CROP_FILTER_BITS_LOG2) / 64, 0);
+  index.min_width = 0;
+  index.min_height = 0;
+  for(uint32_t i=0; i<index.crops.size(); ++i) {
+    const fii_crop_img &crop = index.crops[i];
+    uint64_t bit = fii_crop_filter_bit(crop.anchor_hash);
+    index.anchor_filter[bit / 64] |= ((uint64_t) 1) << (bit % 64);
+    index.crops_of_anchor[crop.anchor_hash].push_back(i);
+    if(i == 0 || crop.width < index.min_width) {
+      index.min_width = crop.width;
+    }
+    if(i == 0 || crop.height < index.min_height) {
+      index.min_height = crop.height;
+    }
+  }
+}
+
+// Images at findex >= folder_findex_offset[k] belong to the k-th folder and,
+// if there are more than one folders, only the crops of an image in a
+// different folder are reported.
+void fii_find_crops(const std::vector<fii_crop_file> &files,
+                    const fii_crop_index &index,
+                    const std::vector<uint32_t> &folder_findex_offset,
+                    std::vector<fii_crop_match> &matches) {
+  matches.clear();
+  if(index.crops.size() == 0) {
+    return;
+  }
+#pragma omp parallel for schedule(dynamic)
+  for(std::size_t i=0; i<files.size(); ++i) {
+    int w, h, nc;
+    if(!stbi_info(files[i].path.c_str(), &w, &h, &nc) ||
+       ((uint32_t) w) < index.min_width || ((uint32_t) h) < index.min_height) {
+      continue; // cannot contain any crop
+    }
+    unsigned char *img_data = stbi_load(files[i].path.c_str(), &w, &h, &nc, 0);
+    if(!img_data) {
+      continue;
+    }
+    uint32_t width = w;
+    uint32_t height = h;
+    uint32_t nchannel = nc;
+    std::size_t img_folder = std::upper_bound(folder_findex_offset.begin(), folder_findex_offset.end(), files[i].findex) - folder_findex_offset.begin();
+
+    uint64_t stride = ((uint64_t) width) * nchannel;
+    uint64_t window_size = FII_CROP_WINDOW_SIZE * nchannel;
+    uint64_t base_power = 1; // FII_CROP_HASH_BASE ^ window_size
+    for(uint64_t k=0; k<window_size; ++k) {
+      base_power *= FII_CROP_HASH_BASE;
+    }
+    std::set<uint32_t> found_crops;
+    std::vector<fii_crop_match> img_matches;
+    std::vector<uint8_t> region_pixels;
+    for(uint32_t y=0; y<height; ++y) {
+      const uint8_t *row = img_data + y * stride;
+      uint64_t hash = fii_crop_region_hash(row, window_size, 1, stride);
+      for(uint32_t x=0; x + FII_CROP_WINDOW_SIZE <= width; ++x) {
+        if(x) {
+          // rolling hash: remove the first pixel and append the next pixel
+          const uint8_t *pixel_out = row + (x - 1) * nchannel;
+          const uint8_t *pixel_in = pixel_out + window_size;
+          for(uint32_t c=0; c<nchannel; ++c) {
+            hash = hash * FII_CROP_HASH_BASE + pixel_in[c] - pixel_out[c] * base_power;
+          }
+        }
+        uint64_t bit = fii_crop_filter_bit(hash);
+        if((index.anchor_filter[bit / 64] & (((uint64_t) 1) << (bit % 64))) == 0) {
+          continue;
+        }
+        std::unordered_map<uint64_t, std::vector<uint32_t> >::const_iterator ai = index.crops_of_anchor.find(hash);
+        if(ai == index.crops_of_anchor.end()) {
+          continue;
+        }
+        for(std::size_t ci=0; ci<ai->second.size(); ++ci) {
+          const fii_crop_img &crop = index.crops[ ai->second[ci] ];
+          if(crop.nchannel != nchannel ||
+             x < crop.anchor_x || y < crop.anchor_y ||
+             (x - crop.anchor_x) + crop.width > width ||
+             (y - crop.anchor_y) + crop.height > height ||
+             (crop.width == width && crop.height == height) ||
+             found_crops.count(crop.findex)) {
+            continue;
+          }
+          if(folder_findex_offset.size() > 1) {
+            std::size_t crop_folder = std::upper_bound(folder_findex_offset.begin(), folder_findex_offset.end(), crop.findex) - folder_findex_offset.begin();
+            if(crop_folder == img_folder) {
+              continue;
+            }
+          }
+          uint32_t crop_x = x - crop.anchor_x;
+          uint32_t crop_y = y - crop.anchor_y;
+          const uint8_t *region = img_data + crop_y * stride + crop_x * nchannel;
+          uint64_t crop_stride = ((uint64_t) crop.width) * nchannel;
+          if(fii_crop_region_hash(region, crop_stride, crop.height, stride) != crop.hash) {
+            continue;
+          }
+          region_pixels.resize(crop_stride * crop.height);
+          for(uint32_t ry=0; ry<crop.height; ++ry) {
+            std::memcpy(&region_pixels[ry * crop_stride], region + ry * stride, crop_stride);
+          }
+          uint64_t region_hash[2];
+          fii_hash128(region_pixels.data(), region_pixels.size(), 0, region_hash);
+          if(region_hash[0] != crop.content_hash[0] || region_hash[1] != crop.content_hash[1]) {
+            continue;
+          }
+          found_crops.insert(crop.findex);
+          fii_crop_match match;
+          match.crop_findex = crop.findex;
+          match.img_findex = files[i].findex;
+          match.x = crop_x;
+          match.y = crop_y;
+          match.width = crop.width;
+          match.height = crop.height;
+          img_matches.push_back(match);
+        }
+      }
+    }
+    stbi_image_free(img_data);
+#pragma omp critical
+    matches.insert(matches.end(), img_matches.begin(), img_matches.end());
+  }
+  std::sort(matches.begin(), matches.end(),
+            [](const fii_crop_match &a, const fii_crop_match &b) {
+              if(a.crop_findex != b.crop_findex) {
+                return a.crop_findex < b.crop_findex;
+              }
+              return a.img_findex < b.img_findex;
+            });
+}
+
+//
+// export crops as a CSV file, img_name[findex] is the name of an image
+//
+bool fii_crop_export_csv(const std::vector<fii_crop_match> &matches,
+                         const std::vector<std::string> &img_name,
+                         const std::string csv_fn) {
+  std::ofstream csv(csv_fn);
+  if(!csv) {
+    return false;
+  }
+  csv << "\"crop\",\"image\",\"x\",\"y\",\"width\",\"height\"" << std::endl;
+  for(std::size_t i=0; i<matches.size(); ++i) {
+    const fii_crop_match &match = matches[i];
+    csv << "\"" << img_name.at(match.crop_findex) << "\",\""
+        << img_name.at(match.img_findex) << "\","
+        << match.x << "," << match.y << ","
+        << match.width << "," << match.height << std::endl;
+  }
+  return csv.good();
+}
+
+#endif
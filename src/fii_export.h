@@ -12,7 +12,10 @@
 #include <vector>
 #include <unordered_map>
 #include <fstream>
+#include <functional>
 
+// _FII_DATA contains the "identical" sets of images and, optionally, the
+// "near-identical" sets of images (see fii_export_json_fstream())
 const char *FII_EXPORT_HTML_JS_STR = R"TEXT(
 var fii_toolbar = document.createElement('div');
 fii_toolbar.setAttribute('class', 'fii_toolbar');
@@ -33,10 +36,21 @@ function fii_init_toolbar() {
   for(var img_dim in _FII_DATA['identical']) {
     var oi = document.createElement('option');
     oi.setAttribute('value', img_dim);
+    oi.setAttribute('data-section', 'identical');
     var set_count = Object.keys(_FII_DATA['identical'][img_dim]).length;
     oi.innerHTML = set_count + ' sets of identical images exists in images with dimension = ' + img_dim;
     set_selector.appendChild(oi);
   }
+  if(_FII_DATA.hasOwnProperty('near-identical')) {
+    for(var img_dim in _FII_DATA['near-identical']) {
+      var oi = document.createElement('option');
+      oi.setAttribute('value', img_dim);
+      oi.setAttribute('data-section', 'near-identical');
+      var set_count = Object.keys(_FII_DATA['near-identical'][img_dim]).length;
+      oi.innerHTML = set_count + ' sets of near identical images';
+      set_selector.appendChild(oi);
+    }
+  }
   set_selector.addEventListener('change', fii_on_img_dim_select);
   set_selector.selectedIndex = 0;
 
@@ -57,9 +71,10 @@ function fii_init_toolbar() {
 function fii_on_img_dim_select(e) {
   var select = e.target;
   img_dim = select.options[select.selectedIndex].value;
+  var section = select.options[select.selectedIndex].getAttribute('data-section');
 
   fii_content.innerHTML = '';
-  for(var set_id in _FII_DATA['identical'][img_dim]) {
+  for(var set_id in _FII_DATA[section][img_dim]) {
     var set_content = document.createElement('div');
     set_content.setAttribute('class', 'set');
     set_content.setAttribute('data-img_dim', img_dim);
@@ -68,10 +83,10 @@ function fii_on_img_dim_select(e) {
     set_id_container.setAttribute('class', 'set_id');
     set_id_container.innerHTML = set_id;
     set_content.appendChild(set_id_container);
-    var set_size = _FII_DATA['identical'][img_dim][set_id].length;
+    var set_size = _FII_DATA[section][img_dim][set_id].length;
     for(var i=0; i<set_size; ++i) {
       var img = document.createElement('img');
-      var filename = _FII_DATA['identical'][img_dim][set_id][i];
+      var filename = _FII_DATA[section][img_dim][set_id][i];
       var filename_prefix_id = filename.split('/')[0] + '/';
       var filename_prefix = _FII_FILENAME_PREFIX_LIST[filename_prefix_id];
       var filename_abs_path = filename.replace(filename_prefix_id, filename_prefix);
@@ -111,56 +126,99 @@ function fii_save_data_to_local_file(data, filename) {
 
 )TEXT";
 
-void fii_export_json_fstream(const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
-                             const std::vector<std::string> &filename_list1,
-                             const std::string check_dir1,
-                             const std::vector<std::string> &filename_list2,
-                             const std::string check_dir2,
-                             std::ofstream &json) {
-  json << "{\"identical\":{";
-  std::unordered_map<std::string, std::vector<std::set<uint32_t> > >::const_iterator bi;
+// name of an image (e.g. dir1/filename) in the exported results
+typedef std::function<std::string(uint32_t)> fii_img_name_fn;
+
+// findex of images in check_dir2 starts after all images of check_dir1
+fii_img_name_fn fii_export_img_name_fn(const std::vector<std::string> &filename_list1,
+                                       const std::string check_dir1,
+                                       const std::vector<std::string> &filename_list2,
+                                       const std::string check_dir2) {
   std::string dir1_name = fii::fs_dirname(check_dir1);
   std::string dir2_name = fii::fs_dirname(check_dir2);
+  return [&filename_list1, &filename_list2, dir1_name, dir2_name](uint32_t findex) -> std::string {
+    if(findex >= filename_list1.size()) {
+      // findex is from check_dir2
+      return dir2_name + "/" + filename_list2.at(findex - filename_list1.size());
+    }
+    // findex is from check_dir1
+    return dir1_name + "/" + filename_list1.at(findex);
+  };
+}
+
+// show a group of images as "  [group_id] : image1, image2, ..." where the
+// group_id is prefixed by label (e.g. the bucket of the group)
+void fii_show_img_group(const std::string label,
+                        const std::size_t group_id,
+                        const std::set<uint32_t> &group_members,
+                        const fii_img_name_fn &img_name) {
+  std::cout << "  " << label << "[" << group_id << "] : ";
+  std::set<uint32_t>::const_iterator si;
+  for(si=group_members.begin(); si!=group_members.end(); ++si) {
+    if(si!= group_members.begin()) {
+      std::cout << ", ";
+    }
+    std::cout << img_name(*si);
+  }
+  std::cout << std::endl;
+}
+
+// groups found by a search (e.g. resized copies) are listed after a title
+void fii_show_img_groups(const std::string title,
+                         const std::vector<std::set<uint32_t> > &groups,
+                         const fii_img_name_fn &img_name) {
+  if(groups.size()) {
+    std::cout << title << std::endl;
+  }
+  for(std::size_t group_id=0; group_id<groups.size(); ++group_id) {
+    fii_show_img_group("", group_id, groups[group_id], img_name);
+  }
+}
 
+// sets of images in each bucket as {bucket:{set_id:[filename, ...]}}
+void fii_export_json_groups_fstream(const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
+                                    const fii_img_name_fn &img_name,
+                                    std::ofstream &json) {
+  json << "{";
+  std::unordered_map<std::string, std::vector<std::set<uint32_t> > >::const_iterator bi;
   for(bi=image_groups.begin(); bi!=image_groups.end(); ++bi) {
     if(bi != image_groups.begin()) {
       json << ",";
     }
     json << "\"" << bi->first << "\":{";
-    std::vector<std::set<uint32_t> >::const_iterator gi;
     for(std::size_t group_id=0; group_id!=bi->second.size(); ++group_id) {
-      std::set<uint32_t> group_members(bi->second.at(group_id));
+      const std::set<uint32_t> &group_members = bi->second.at(group_id);
       std::set<uint32_t>::const_iterator si;
       if(group_id!=0) {
         json << ",";
       }
       json << "\"" << group_id << "\":[";
       for(si=group_members.begin(); si!=group_members.end(); ++si) {
-        uint32_t findex = *si;
-        std::string filename;
-        std::string dir_name;
-        if(findex >= filename_list1.size()) {
-          // findex is from check_dir2
-          findex = findex - filename_list1.size();
-          filename = filename_list2.at(findex);
-          dir_name = dir2_name;
-        } else {
-          // findex is from check_dir1
-          filename = filename_list1.at(findex);
-          dir_name = dir1_name;
-        }
-
         if(si!= group_members.begin()) {
-          json << ",\"" << dir_name << "/" << filename << "\"";
-        } else {
-          json << "\"" << dir_name << "/" << filename << "\"";
+          json << ",";
         }
+        json << "\"" << img_name(*si) << "\"";
       }
       json << "]";
     }
     json << "}";
   }
-  json << "}}";
+  json << "}";
+}
+
+// near identical images (if any) are exported in a separate section
+void fii_export_json_fstream(const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
+                             const fii_img_name_fn &img_name,
+                             std::ofstream &json,
+                             const std::vector<std::set<uint32_t> > &near_groups=std::vector<std::set<uint32_t> >()) {
+  json << "{\"identical\":";
+  fii_export_json_groups_fstream(image_groups, img_name, json);
+  if(near_groups.size()) {
+    std::unordered_map<std::string, std::vector<std::set<uint32_t> > > near_image_groups = { {"all", near_groups} };
+    json << ",\"near-identical\":";
+    fii_export_json_groups_fstream(near_image_groups, img_name, json);
+  }
+  json << "}";
 }
 
 void fii_export_json(const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
@@ -168,48 +226,29 @@ void fii_export_json(const std::unordered_map<std::string, std::vector<std::set<
                      const std::vector<std::string> &filename_list1,
                      const std::string check_dir1,
                      const std::vector<std::string> &filename_list2=std::vector<std::string>(),
-                     const std::string check_dir2="") {
+                     const std::string check_dir2="",
+                     const std::vector<std::set<uint32_t> > &near_groups=std::vector<std::set<uint32_t> >()) {
   std::ofstream json(json_fn);
-  fii_export_json_fstream(image_groups, filename_list1, check_dir1, filename_list2, check_dir2, json);
+  fii_export_json_fstream(image_groups,
+                          fii_export_img_name_fn(filename_list1, check_dir1, filename_list2, check_dir2),
+                          json, near_groups);
   json.close();
 }
 
 void fii_export_csv(const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
                     const std::string csv_fn,
-                    const std::vector<std::string> &filename_list1,
-                    const std::string check_dir1,
-                    const std::vector<std::string> &filename_list2=std::vector<std::string>(),
-                    const std::string check_dir2="") {
+                    const fii_img_name_fn &img_name) {
   std::ofstream csv(csv_fn);
-  std::string dir1_name = fii::fs_dirname(check_dir1);
-  std::string dir2_name = fii::fs_dirname(check_dir2);
   std::unordered_map<std::string, std::vector<std::set<uint32_t> > >::const_iterator bi;
   for(bi=image_groups.begin(); bi!=image_groups.end(); ++bi) {
-    uint32_t group_id = 0;
-    std::vector<std::set<uint32_t> >::const_iterator gi;
     for(std::size_t group_id=0; group_id!=bi->second.size(); ++group_id) {
-      std::set<uint32_t> group_members(bi->second.at(group_id));
+      const std::set<uint32_t> &group_members = bi->second.at(group_id);
       std::set<uint32_t>::const_iterator si;
       for(si=group_members.begin(); si!=group_members.end(); ++si) {
-        uint32_t findex = *si;
-        std::string filename;
-        std::string dir_name;
-        if(findex >= filename_list1.size()) {
-          // findex is from check_dir2
-          findex = findex - filename_list1.size();
-          filename = filename_list2.at(findex);
-          dir_name = dir2_name;
-        } else {
-          // findex is from check_dir1
-          filename = filename_list1.at(findex);
-          dir_name = dir1_name;
-        }
-
         if(si!= group_members.begin()) {
-          csv << ",\"" << dir_name << "/" << filename << "\"";
-        } else {
-          csv << "\"" << dir_name << "/" << filename << "\"";
+          csv << ",";
         }
+        csv << "\"" << img_name(*si) << "\"";
       }
       csv << std::endl;
     }
@@ -222,7 +261,8 @@ void fii_export_html(const std::unordered_map<std::string, std::vector<std::set<
                      const std::vector<std::string> &filename_list1,
                      const std::string check_dir1,
                      const std::vector<std::string> &filename_list2=std::vector<std::string>(),
-                     const std::string check_dir2="") {
+                     const std::string check_dir2="",
+                     const std::vector<std::set<uint32_t> > &near_groups=std::vector<std::set<uint32_t> >()) {
   std::ofstream html(html_fn);
   html << "<!DOCTYPE html>\n"
        << "<html lang=\"en\">\n"
@@ -247,7 +287,9 @@ void fii_export_html(const std::unordered_map<std::string, std::vector<std::set<
        << "var _FII_FILENAME_PREFIX_LIST = {\"" << dir1_name << "\":\"" << check_dir1 << "\""
        << ",\"" << dir2_name << "\":\"" << check_dir2 << "\"};\n"
        << "var _FII_DATA = ";
-  fii_export_json_fstream(image_groups, filename_list1, check_dir1, filename_list2, check_dir2, html);
+  fii_export_json_fstream(image_groups,
+                          fii_export_img_name_fn(filename_list1, check_dir1, filename_list2, check_dir2),
+                          html, near_groups);
   html << ";\n";
   html << "\n"
        << FII_EXPORT_HTML_JS_STR
@@ -335,18 +377,25 @@ void fii_export_all(const std::unordered_map<std::string, std::vector<std::set<u
                     const std::vector<std::string> &filename_list1,
                     std::string check_dir1,
                     const std::vector<std::string> &filename_list2=std::vector<std::string>(),
-                    std::string check_dir2="") {
+                    std::string check_dir2="",
+                    const std::vector<std::set<uint32_t> > &near_groups=std::vector<std::set<uint32_t> >()) {
   try {
     std::string prefix = fii::fs_dirname(check_dir1);
     if(check_dir2 != "") {
       prefix += "-" + fii::fs_dirname(check_dir2);
     }
     std::string json_fn = export_dir + prefix + "-identical.json";
-    fii_export_json(image_groups, json_fn, filename_list1, check_dir1, filename_list2, check_dir2);
+    fii_export_json(image_groups, json_fn, filename_list1, check_dir1, filename_list2, check_dir2, near_groups);
     std::string html_fn = export_dir + prefix + "-identical.html";
-    fii_export_html(image_groups, html_fn, filename_list1, check_dir1, filename_list2, check_dir2);
+    fii_export_html(image_groups, html_fn, filename_list1, check_dir1, filename_list2, check_dir2, near_groups);
+    fii_img_name_fn img_name = fii_export_img_name_fn(filename_list1, check_dir1, filename_list2, check_dir2);
     std::string csv_fn = export_dir + prefix + "-identical.csv";
-    fii_export_csv(image_groups, csv_fn, filename_list1, check_dir1, filename_list2, check_dir2);
+    fii_export_csv(image_groups, csv_fn, img_name);
+    if(near_groups.size()) {
+      std::unordered_map<std::string, std::vector<std::set<uint32_t> > > near_image_groups = { {"all", near_groups} };
+      std::string near_csv_fn = export_dir + prefix + "-near-identical.csv";
+      fii_export_csv(near_image_groups, near_csv_fn, img_name);
+    }
     std::string filelist_fn = export_dir + prefix + "-identical-filelist.txt";
     fii_export_filelist(image_groups, filelist_fn, filename_list1, check_dir1, filename_list2, check_dir2);
     std::string delete_filelist_fn = export_dir + prefix + "-identical-delete-filelist.txt";
@@ -355,7 +404,7 @@ void fii_export_all(const std::unordered_map<std::string, std::vector<std::set<u
     std::cout << "Results in " << export_dir << std::endl;
   } catch(std::exception &ex) {
     std::string json_fn = "identical.json";
-    fii_export_json(image_groups, json_fn, filename_list1, check_dir1, filename_list2, check_dir2);
+    fii_export_json(image_groups, json_fn, filename_list1, check_dir1, filename_list2, check_dir2, near_groups);
     std::cerr << "Error while saving, dumping results to "
               << json_fn << std::endl;
   }
@@ -369,7 +418,8 @@ void fii_export(const std::unordered_map<std::string, std::vector<std::set<uint3
                 std::string check_dir2="") {
   std::string export_fn_ext = fii::fs_file_extension(export_fn);
   if(export_fn_ext == "csv" || export_fn_ext == "CSV") {
-    fii_export_csv(image_groups, export_fn, filename_list1, check_dir1, filename_list2, check_dir2);
+    fii_export_csv(image_groups, export_fn,
+                   fii_export_img_name_fn(filename_list1, check_dir1, filename_list2, check_dir2));
     std::cout << "Results written to CSV file " << export_fn << std::endl;
   } else if(export_fn_ext == "json" || export_fn_ext == "JSON") {
     fii_export_json(image_groups, export_fn, filename_list1, check_dir1, filename_list2, check_dir2);
@@ -384,4 +434,127 @@ void fii_export(const std::unordered_map<std::string, std::vector<std::set<uint3
   }
 }
 
+//
+// export results of N folders (i.e. CHECK_DIR1 CHECK_DIR2 CHECK_DIR3 ...)
+// findex of images in k-th folder starts after all images of previous folders
+//
+std::string fii_export_img_name(uint32_t findex,
+                                const std::vector<std::vector<std::string> > &filename_lists,
+                                const std::vector<std::string> &dir_name_list) {
+  for(std::size_t k=0; k<filename_lists.size(); ++k) {
+    if(findex < filename_lists[k].size()) {
+      return dir_name_list[k] + "/" + filename_lists[k][findex];
+    }
+    findex = findex - filename_lists[k].size();
+  }
+  return "";
+}
+
+fii_img_name_fn fii_export_img_name_fn(const std::vector<std::vector<std::string> > &filename_lists,
+                                       const std::vector<std::string> &check_dir_list) {
+  std::vector<std::string> dir_name_list;
+  for(std::size_t k=0; k<check_dir_list.size(); ++k) {
+    dir_name_list.push_back(fii::fs_dirname(check_dir_list[k]));
+  }
+  return [&filename_lists, dir_name_list](uint32_t findex) -> std::string {
+    return fii_export_img_name(findex, filename_lists, dir_name_list);
+  };
+}
+
+void fii_export_multi_html(const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
+                           const std::string html_fn,
+                           const std::vector<std::vector<std::string> > &filename_lists,
+                           const std::vector<std::string> &check_dir_list) {
+  std::ofstream html(html_fn);
+  html << "<!DOCTYPE html>\n"
+       << "<html lang=\"en\">\n"
+       << "<head>\n"
+       << "<meta charset=\"UTF-8\">\n"
+       << "<title>Identical Images</title>\n"
+       << "<meta name=\"author\" content=\"Find Identical Images (FII) - https://www.robots.ox.ac.uk/~vgg/software/fii/\">\n"
+       << "<style>.fii_toolbar button { margin:0 2em; } .set{ position:relative; display:inline-block; border:1px solid #cccccc; margin:2em 1em; padding:2em; font-size:small; } .set > .set_id{ position:absolute; top:0; left:0; padding:0.2em 0.5em; background-color:black; color:white; } .set figure{ display:inline-block; margin:0.2em 0.3em; } .set figure img{ max-width:300px; max-height:300px; }</style>\n";
+  html << "</head>\n<body>";
+  html << "<h1>Identical images between";
+  for(std::size_t k=0; k<check_dir_list.size(); ++k) {
+    html << " [" << fii::fs_dirname(check_dir_list[k]) << "/]";
+  }
+  html << "</h1>\n";
+  html << "<script>\n"
+       << "var _FII_FILENAME_PREFIX_LIST = {";
+  for(std::size_t k=0; k<check_dir_list.size(); ++k) {
+    if(k) {
+      html << ",";
+    }
+    html << "\"" << fii::fs_dirname(check_dir_list[k]) << "/\":\"" << check_dir_list[k] << "\"";
+  }
+  html << "};\n"
+       << "var _FII_DATA = ";
+  fii_export_json_fstream(image_groups, fii_export_img_name_fn(filename_lists, check_dir_list), html);
+  html << ";\n";
+  html << "\n"
+       << FII_EXPORT_HTML_JS_STR
+       << "\n</script>\n"
+       << "</body>\n"
+       << "</html>";
+
+  html.close();
+}
+
+// leakage[i][j] is the number of images in i-th folder that have an
+// identical copy in j-th folder
+void fii_export_leakage_matrix_csv(const std::vector<std::vector<uint32_t> > &leakage,
+                                   const std::string csv_fn,
+                                   const std::vector<std::string> &check_dir_list) {
+  std::ofstream csv(csv_fn);
+  csv << "\"folder\"";
+  for(std::size_t j=0; j<check_dir_list.size(); ++j) {
+    csv << ",\"" << fii::fs_dirname(check_dir_list[j]) << "\"";
+  }
+  csv << std::endl;
+  for(std::size_t i=0; i<check_dir_list.size(); ++i) {
+    csv << "\"" << fii::fs_dirname(check_dir_list[i]) << "\"";
+    for(std::size_t j=0; j<check_dir_list.size(); ++j) {
+      csv << "," << leakage[i][j];
+    }
+    csv << std::endl;
+  }
+  csv.close();
+}
+
+void fii_export_multi_all(const std::unordered_map<std::string, std::vector<std::set<uint32_t> > > &image_groups,
+                          const std::vector<std::vector<uint32_t> > &leakage,
+                          std::string export_dir,
+                          const std::vector<std::vector<std::string> > &filename_lists,
+                          const std::vector<std::string> &check_dir_list) {
+  std::string prefix;
+  for(std::size_t k=0; k<check_dir_list.size(); ++k) {
+    if(k) {
+      prefix += "-";
+    }
+    prefix += fii::fs_dirname(check_dir_list[k]);
+  }
+  fii_img_name_fn img_name = fii_export_img_name_fn(filename_lists, check_dir_list);
+  try {
+    std::string json_fn = export_dir + prefix + "-identical.json";
+    std::ofstream json(json_fn);
+    fii_export_json_fstream(image_groups, img_name, json);
+    json.close();
+    std::string html_fn = export_dir + prefix + "-identical.html";
+    fii_export_multi_html(image_groups, html_fn, filename_lists, check_dir_list);
+    std::string csv_fn = export_dir + prefix + "-identical.csv";
+    fii_export_csv(image_groups, csv_fn, img_name);
+    std::string leakage_fn = export_dir + prefix + "-leakage.csv";
+    fii_export_leakage_matrix_csv(leakage, leakage_fn, check_dir_list);
+
+    std::cout << "Results in " << export_dir << std::endl;
+  } catch(std::exception &ex) {
+    std::string json_fn = "identical.json";
+    std::ofstream json(json_fn);
+    fii_export_json_fstream(image_groups, img_name, json);
+    json.close();
+    std::cerr << "Error while saving, dumping results to "
+              << json_fn << std::endl;
+  }
+}
+
 #endif
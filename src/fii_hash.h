@@ -0,0 +1,114 @@
+/*
+  Non-cryptographic hash functions used to partition images into groups of
+  candidate identical images.
+
+  The 128 bit hash is the x64 variant of MurmurHash3 written by Austin
+  Appleby and placed in the public domain.
+  https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
+*/
+
+#ifndef FII_HASH_H
+#define FII_HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+inline uint64_t fii_hash_rotl64(uint64_t x, int8_t r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t fii_hash_fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// MurmurHash3_x64_128() : hash[0] and hash[1] contain the 128 bit hash value
+void fii_hash128(const void *key,
+                 const std::size_t len,
+                 const uint32_t seed,
+                 uint64_t hash[2]) {
+  const uint8_t *data = (const uint8_t *) key;
+  const std::size_t nblocks = len / 16;
+
+  uint64_t h1 = seed;
+  uint64_t h2 = seed;
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+  for(std::size_t i=0; i<nblocks; ++i) {
+    uint64_t k1, k2;
+    std::memcpy(&k1, data + i*16, 8);
+    std::memcpy(&k2, data + i*16 + 8, 8);
+
+    k1 *= c1; k1 = fii_hash_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = fii_hash_rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+
+    k2 *= c2; k2 = fii_hash_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = fii_hash_rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+  }
+
+  const uint8_t *tail = data + nblocks*16;
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+  switch(len & 15) {
+  case 15: k2 ^= ((uint64_t) tail[14]) << 48;
+    // fall through
+  case 14: k2 ^= ((uint64_t) tail[13]) << 40;
+    // fall through
+  case 13: k2 ^= ((uint64_t) tail[12]) << 32;
+    // fall through
+  case 12: k2 ^= ((uint64_t) tail[11]) << 24;
+    // fall through
+  case 11: k2 ^= ((uint64_t) tail[10]) << 16;
+    // fall through
+  case 10: k2 ^= ((uint64_t) tail[ 9]) << 8;
+    // fall through
+  case  9: k2 ^= ((uint64_t) tail[ 8]) << 0;
+    k2 *= c2; k2 = fii_hash_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    // fall through
+  case  8: k1 ^= ((uint64_t) tail[ 7]) << 56;
+    // fall through
+  case  7: k1 ^= ((uint64_t) tail[ 6]) << 48;
+    // fall through
+  case  6: k1 ^= ((uint64_t) tail[ 5]) << 40;
+    // fall through
+  case  5: k1 ^= ((uint64_t) tail[ 4]) << 32;
+    // fall through
+  case  4: k1 ^= ((uint64_t) tail[ 3]) << 24;
+    // fall through
+  case  3: k1 ^= ((uint64_t) tail[ 2]) << 16;
+    // fall through
+  case  2: k1 ^= ((uint64_t) tail[ 1]) << 8;
+    // fall through
+  case  1: k1 ^= ((uint64_t) tail[ 0]) << 0;
+    k1 *= c1; k1 = fii_hash_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+  }
+
+  h1 ^= (uint64_t) len;
+  h2 ^= (uint64_t) len;
+  h1 += h2;
+  h2 += h1;
+  h1 = fii_hash_fmix64(h1);
+  h2 = fii_hash_fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+
+  hash[0] = h1;
+  hash[1] = h2;
+}
+
+// 64 bit hash used as a key for hash partitioning
+uint64_t fii_hash64(const void *key,
+                    const std::size_t len,
+                    const uint32_t seed=0) {
+  uint64_t hash[2];
+  fii_hash128(key, len, seed, hash);
+  return hash[0];
+}
+
+#endif
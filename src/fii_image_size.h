@@ -13,17 +13,193 @@ Revision History:
 #ifndef FII_IMAGE_SIZE_H
 #define FII_IMAGE_SIZE_H
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
 #include "stb_image.h"
 
+// Cheap check (without decoding the image data) to reject truncated JPEG,
+// PNG and BMP files whose header is intact. Other formats are not checked.
+//  - JPEG: the marker segments (APPn, DQT, DHT, SOFn, ...) are walked using
+//    their length until the first scan (SOS) and the end of image marker
+//    (0xFFD9) must be present after the start of the scan data. Markers in
+//    embedded data (e.g. an EXIF thumbnail) are therefore never mistaken for
+//    the end of image. The marker is looked up in the tail of the file first
+//    and, only if absent (e.g. data appended after the image), in all the scan
+//    data.
+//  - PNG : the chunks are walked (without reading their data) until the IEND
+//    chunk which must not extend beyond the end of file.
+//  - BMP : uncompressed pixel data must not extend beyond the end of file.
+const long FII_IMAGE_TAIL_SIZE = 4096;
+
+bool fii_image_find_jpeg_eoi(FILE *f,
+                             const long start,
+                             const long size) {
+  unsigned char buffer[FII_IMAGE_TAIL_SIZE];
+  int last = -1; // last byte of previous block
+  long offset = start;
+  fseek(f, start, SEEK_SET);
+  while(offset < size) {
+    std::size_t n = fread(buffer, 1, sizeof(buffer), f);
+    if(n == 0) {
+      break;
+    }
+    for(std::size_t i=0; i<n; ++i) {
+      if(buffer[i] == 0xD9 && last == 0xFF) {
+        return true;
+      }
+      last = buffer[i];
+    }
+    offset += n;
+  }
+  return false;
+}
+
+// offset of the entropy coded data of the first scan of a JPEG file (i.e.
+// the end of the SOS segment) or -1 if the file ends before it
+long fii_image_find_jpeg_scan(FILE *f,
+                              const long size) {
+  unsigned char marker[4];
+  long offset = 2; // after SOI
+  while((offset + 2) <= size) {
+    fseek(f, offset, SEEK_SET);
+    if(fread(marker, 1, 2, f) != 2) {
+      return -1;
+    }
+    if(marker[0] != 0xFF) {
+      return offset; // not a marker, left to the decoder
+    }
+    if(marker[1] == 0xFF) {
+      offset += 1; // fill byte
+      continue;
+    }
+    if(marker[1] == 0xD9) {
+      return -1; // end of image before any scan
+    }
+    if(marker[1] == 0x01 || (marker[1] >= 0xD0 && marker[1] <= 0xD8)) {
+      offset += 2; // TEM, RSTn and SOI have no length
+      continue;
+    }
+    if((offset + 4) > size || fread(marker + 2, 1, 2, f) != 2) {
+      return -1;
+    }
+    long segment_end = offset + 2 + ((((long) marker[2]) << 8) | marker[3]);
+    if(segment_end > size) {
+      return -1;
+    }
+    if(marker[1] == 0xDA) {
+      return segment_end;
+    }
+    offset = segment_end;
+  }
+  return -1;
+}
+
+uint32_t fii_image_get_u32(const unsigned char *data, const bool big_endian) {
+  if(big_endian) {
+    return (((uint32_t) data[0]) << 24) | (((uint32_t) data[1]) << 16) |
+      (((uint32_t) data[2]) << 8) | ((uint32_t) data[3]);
+  }
+  return (((uint32_t) data[3]) << 24) | (((uint32_t) data[2]) << 16) |
+    (((uint32_t) data[1]) << 8) | ((uint32_t) data[0]);
+}
+
+uint16_t fii_image_get_u16(const unsigned char *data) {
+  return (((uint16_t) data[1]) << 8) | ((uint16_t) data[0]);
+}
+
+bool fii_image_file_is_complete(FILE *f) {
+  unsigned char header[54];
+  fseek(f, 0, SEEK_SET);
+  std::size_t header_size = fread(header, 1, sizeof(header), f);
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  bool is_complete = true;
+
+  if(header_size >= 3 && header[0] == 0xFF && header[1] == 0xD8 && header[2] == 0xFF) {
+    long scan_start = fii_image_find_jpeg_scan(f, size);
+    if(scan_start < 0) {
+      is_complete = false;
+    } else {
+      long tail_start = std::max(scan_start, size - FII_IMAGE_TAIL_SIZE);
+      is_complete = fii_image_find_jpeg_eoi(f, tail_start, size);
+      if(!is_complete && tail_start > scan_start) {
+        is_complete = fii_image_find_jpeg_eoi(f, scan_start, size);
+      }
+    }
+  } else if(header_size >= 8 &&
+            std::memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0) {
+    is_complete = false;
+    long offset = 8;
+    unsigned char chunk[8];
+    while((offset + 12) <= size) {
+      fseek(f, offset, SEEK_SET);
+      if(fread(chunk, 1, 8, f) != 8) {
+        break;
+      }
+      // length, type, data and crc
+      long chunk_end = offset + 12 + (long) fii_image_get_u32(chunk, true);
+      if(chunk_end > size) {
+        break;
+      }
+      if(std::memcmp(chunk + 4, "IEND", 4) == 0) {
+        is_complete = true;
+        break;
+      }
+      offset = chunk_end;
+    }
+  } else if(header_size >= 2 && header[0] == 'B' && header[1] == 'M') {
+    if(header_size < 30) {
+      return false; // truncated header
+    }
+    uint64_t data_offset = fii_image_get_u32(header + 10, false);
+    uint32_t info_size = fii_image_get_u32(header + 14, false);
+    int64_t width, height;
+    uint32_t bpp, compression;
+    if(info_size == 12) {
+      width = fii_image_get_u16(header + 18);
+      height = fii_image_get_u16(header + 20);
+      bpp = fii_image_get_u16(header + 24);
+      compression = 0;
+    } else {
+      width = (int32_t) fii_image_get_u32(header + 18, false);
+      height = (int32_t) fii_image_get_u32(header + 22, false);
+      bpp = fii_image_get_u16(header + 28);
+      compression = (header_size >= 34) ? fii_image_get_u32(header + 30, false) : 0;
+    }
+    // only uncompressed (BI_RGB, BI_BITFIELDS) pixel data has a known size
+    if(compression == 0 || compression == 3) {
+      uint64_t row_size = ((bpp * (uint64_t) std::llabs(width) + 31) / 32) * 4;
+      uint64_t expected_size = data_offset + row_size * (uint64_t) std::llabs(height);
+      is_complete = ((uint64_t) size) >= expected_size;
+    }
+  }
+  return is_complete;
+}
+
+bool fii_image_is_complete(const char *filename) {
+  FILE *f = stbi__fopen(filename, "rb");
+  if (!f) return false;
+  bool is_complete = fii_image_file_is_complete(f);
+  fclose(f);
+  return is_complete;
+}
+
+// if is_complete is not NULL, the image is also checked (see
+// fii_image_file_is_complete) without opening the file again
 void fii_image_size(const char *filename,
                     int *width,
                     int *height,
-                    int *nchannel) {
+                    int *nchannel,
+                    bool *is_complete=NULL) {
   *width    = 0;
   *height   = 0;
   *nchannel = 0;
+  if (is_complete) *is_complete = false;
 
   FILE *f = stbi__fopen(filename, "rb");
   unsigned char *stb_op_result;
@@ -90,7 +266,12 @@ void fii_image_size(const char *filename,
     }
   }
 
+  if (is_complete) {
+    *is_complete = *width && fii_image_file_is_complete(f);
+  }
+
   // cleanup
   fclose(f);
 }
+
 #endif
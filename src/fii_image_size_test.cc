@@ -2,6 +2,8 @@
 #include <string>
 #include <vector>
 #include <cstdio>
+#include <fstream>
+#include <iterator>
 
 #include "fii_util.h"
 #include "fii_image_size.h"
@@ -64,7 +66,28 @@ int main(int argc, char **argv) {
           fii_image_size(filename.c_str(),
                          &got_width, &got_height, &got_nchannel);
 
+          // a truncated copy of the image must be detected
+          bool is_complete = fii_image_is_complete(filename.c_str());
+          std::string truncated_filename = testdir + filename_template + "_truncated." + type;
+          std::ifstream image_file(filename, std::ios::binary);
+          std::string image_bytes((std::istreambuf_iterator<char>(image_file)),
+                                  std::istreambuf_iterator<char>());
+          image_file.close();
+          std::ofstream truncated_file(truncated_filename, std::ios::binary);
+          truncated_file.write(image_bytes.data(), image_bytes.size() / 2);
+          truncated_file.close();
+          bool is_truncated_complete = fii_image_is_complete(truncated_filename.c_str());
+
           std::remove(filename.c_str());
+          std::remove(truncated_filename.c_str());
+
+          if(!is_complete || is_truncated_complete) {
+            std::cout << type << " image truncation check failed!"
+                      << " complete image: " << is_complete
+                      << ", truncated image: " << is_truncated_complete
+                      << std::endl;
+            return EXIT_FAILURE;
+          }
 
           if(got_width != width ||
              got_height != height ||
@@ -81,6 +104,52 @@ int main(int argc, char **argv) {
       }
     }
   }
+
+  // a truncated JPEG containing a thumbnail (i.e. a complete JPEG with its
+  // own end of image marker) in the EXIF segment must be detected
+  std::cout << "Testing jpg image with an EXIF thumbnail ..." << std::endl;
+  std::string image_filename = testdir + filename_template + ".jpg";
+  std::string thumbnail_filename = testdir + filename_template + "_thumbnail.jpg";
+  std::vector<uint8_t> image_data(640 * 480 * 3);
+  for(std::size_t i=0; i<image_data.size(); ++i) {
+    image_data[i] = (i * 7) % 251;
+  }
+  if(!stbi_write_jpg(image_filename.c_str(), 640, 480, 3, image_data.data(), 90) ||
+     !stbi_write_jpg(thumbnail_filename.c_str(), 160, 120, 3, image_data.data(), 90)) {
+    std::cout << "failed to create jpg test images" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string file_bytes[2];
+  std::string file_list[2] = { image_filename, thumbnail_filename };
+  for(int k=0; k<2; ++k) {
+    std::ifstream f(file_list[k], std::ios::binary);
+    file_bytes[k].assign((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  }
+  std::string app1("Exif\0\0", 6);
+  app1 += file_bytes[1];
+  std::string segment_length;
+  segment_length.push_back((char) (((app1.size() + 2) >> 8) & 0xFF));
+  segment_length.push_back((char) ((app1.size() + 2) & 0xFF));
+  std::string exif_bytes = file_bytes[0].substr(0, 2) + "\xFF\xE1" + segment_length + app1 +
+    file_bytes[0].substr(2);
+  std::size_t truncated_size = exif_bytes.size() - (file_bytes[0].size() / 2);
+  bool is_exif_complete[2];
+  for(int k=0; k<2; ++k) {
+    std::ofstream f(image_filename, std::ios::binary | std::ios::trunc);
+    f.write(exif_bytes.data(), k ? truncated_size : exif_bytes.size());
+    f.close();
+    is_exif_complete[k] = fii_image_is_complete(image_filename.c_str());
+  }
+  std::remove(image_filename.c_str());
+  std::remove(thumbnail_filename.c_str());
+  if(!is_exif_complete[0] || is_exif_complete[1]) {
+    std::cout << "jpg image with EXIF thumbnail truncation check failed!"
+              << " complete image: " << is_exif_complete[0]
+              << ", truncated image: " << is_exif_complete[1]
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
   fii::remove_testdir(testname);
   return EXIT_SUCCESS;
 }
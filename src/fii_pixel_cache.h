@@ -0,0 +1,264 @@
+/*
+  Cache of decoded pixel values shared by the two passes of the search. Pass 1
+  decodes every image to compute its features and pass 2 (i.e. the exact or
+  near tier) decodes the candidate images again to compare all their pixel
+  values. The pixels of images decoded in pass 1 are retained (within a memory
+  budget) so that pass 2 does not decode these candidates again.
+
+  Each entry records the number of pending comparisons that still need its
+  pixels. Entries without any known pending comparison (i.e. 0) are evicted
+  first in least recently used order when the budget is exceeded. Entries with
+  pending comparisons are only evicted to make room for an image that has more
+  pending comparisons, fewest pending comparisons first, and an evicted image
+  is decoded again by its comparisons. An entry is released as soon as its
+  last pending comparison takes the pixels.
+
+  In pass 1, an image whose key (see fii_pixel_cache_put_keyed) is same as that
+  of an earlier image is a candidate and the comparison is recorded for both
+  images. Once the candidate groups are known, the first image of a group is
+  compared with each of the other images (see fii_confirm_identical_img).
+*/
+
+#ifndef FII_PIXEL_CACHE_H
+#define FII_PIXEL_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+const uint64_t FII_PIXEL_CACHE_SIZE_DEFAULT = 512; // in MB
+const uint64_t FII_PIXEL_CACHE_SIZE_MAX = 1048576; // in MB
+
+struct fii_pixel_cache_entry {
+  std::vector<uint8_t> pixels;
+  uint32_t pending_count;
+  std::list<uint32_t>::iterator lru_it;
+};
+
+struct fii_pixel_cache {
+  uint64_t max_size = 0; // in bytes, 0 disables the cache
+  uint64_t size = 0;
+  uint64_t hit_count = 0;
+  uint64_t eviction_count = 0;
+  std::list<uint32_t> lru; // entries without pending comparison, least recently used first
+  std::set<std::pair<uint32_t, uint32_t> > pinned; // (pending count, findex) of other entries
+  std::unordered_map<uint32_t, fii_pixel_cache_entry> entries;
+  std::unordered_map<uint64_t, uint32_t> first_findex_of_key;
+  std::mutex lock;
+};
+
+void fii_pixel_cache_init(fii_pixel_cache &cache,
+                          const uint64_t max_size) {
+  cache.max_size = max_size;
+  cache.size = 0;
+  cache.hit_count = 0;
+  cache.eviction_count = 0;
+  cache.lru.clear();
+  cache.pinned.clear();
+  cache.entries.clear();
+  cache.first_findex_of_key.clear();
+}
+
+bool fii_pixel_cache_is_enabled(const fii_pixel_cache &cache) {
+  return cache.max_size != 0;
+}
+
+// number of comparisons of an image with the other images of its candidate
+// group: the first image is compared with all the other images
+uint32_t fii_pixel_cache_comparison_count(const std::set<uint32_t> &group,
+                                          const uint32_t findex) {
+  if(findex == *group.begin() && group.size() > 1) {
+    return group.size() - 1;
+  }
+  return 1;
+}
+
+// must be called with cache.lock held
+void fii_pixel_cache_set_pending(fii_pixel_cache &cache,
+                                 std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator it,
+                                 const uint32_t pending_count) {
+  if(it->second.pending_count == 0) {
+    cache.lru.erase(it->second.lru_it);
+  } else {
+    cache.pinned.erase(std::make_pair(it->second.pending_count, it->first));
+  }
+  it->second.pending_count = pending_count;
+  if(pending_count == 0) {
+    it->second.lru_it = cache.lru.insert(cache.lru.end(), it->first);
+  } else {
+    cache.pinned.insert(std::make_pair(pending_count, it->first));
+  }
+}
+
+// must be called with cache.lock held
+void fii_pixel_cache_erase_entry(fii_pixel_cache &cache,
+                                 std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator it) {
+  if(it->second.pending_count == 0) {
+    cache.lru.erase(it->second.lru_it);
+  } else {
+    cache.pinned.erase(std::make_pair(it->second.pending_count, it->first));
+  }
+  cache.size -= it->second.pixels.size();
+  cache.entries.erase(it);
+}
+
+// must be called with cache.lock held
+bool fii_pixel_cache_put_locked(fii_pixel_cache &cache,
+                                const uint32_t findex,
+                                std::vector<uint8_t> &pixels,
+                                const uint32_t pending_count) {
+  std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator it = cache.entries.find(findex);
+  if(it != cache.entries.end()) {
+    fii_pixel_cache_erase_entry(cache, it);
+  }
+  while((cache.size + pixels.size()) > cache.max_size) {
+    uint32_t evicted_findex;
+    if(cache.lru.size()) {
+      evicted_findex = cache.lru.front();
+    } else if(cache.pinned.size() && cache.pinned.begin()->first < pending_count) {
+      evicted_findex = cache.pinned.begin()->second;
+    } else {
+      return false; // all entries have as many pending comparisons
+    }
+    fii_pixel_cache_erase_entry(cache, cache.entries.find(evicted_findex));
+    cache.eviction_count += 1;
+  }
+  fii_pixel_cache_entry &entry = cache.entries[findex];
+  entry.pixels.swap(pixels);
+  entry.pending_count = pending_count;
+  if(pending_count == 0) {
+    entry.lru_it = cache.lru.insert(cache.lru.end(), findex);
+  } else {
+    cache.pinned.insert(std::make_pair(pending_count, findex));
+  }
+  cache.size += entry.pixels.size();
+  return true;
+}
+
+// pixels are moved into the cache only if they fit in the budget after
+// evicting entries with fewer pending comparisons
+bool fii_pixel_cache_put(fii_pixel_cache &cache,
+                         const uint32_t findex,
+                         std::vector<uint8_t> &pixels,
+                         const uint32_t pending_count=0) {
+  if(pixels.size() == 0 || pixels.size() > cache.max_size) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(cache.lock);
+  return fii_pixel_cache_put_locked(cache, findex, pixels, pending_count);
+}
+
+// put the pixels of an image decoded in pass 1 whose feature key is key, an
+// image with the same key as an earlier image is compared with the first image
+// of the key. The key is registered under the cache lock such that the first
+// image of a key is always in the cache (or evicted) when a later image
+// records its comparison.
+bool fii_pixel_cache_put_keyed(fii_pixel_cache &cache,
+                               const uint32_t findex,
+                               const uint64_t key,
+                               std::vector<uint8_t> &pixels) {
+  std::lock_guard<std::mutex> guard(cache.lock);
+  uint32_t first_findex = cache.first_findex_of_key.insert(std::make_pair(key, findex)).first->second;
+  if(first_findex == findex) {
+    if(pixels.size() == 0 || pixels.size() > cache.max_size) {
+      return false;
+    }
+    return fii_pixel_cache_put_locked(cache, findex, pixels, 0);
+  }
+  std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator it = cache.entries.find(first_findex);
+  if(it != cache.entries.end()) {
+    fii_pixel_cache_set_pending(cache, it, it->second.pending_count + 1);
+  }
+  if(pixels.size() == 0 || pixels.size() > cache.max_size) {
+    return false;
+  }
+  return fii_pixel_cache_put_locked(cache, findex, pixels, 1);
+}
+
+bool fii_pixel_cache_contains(fii_pixel_cache &cache,
+                              const uint32_t findex) {
+  std::lock_guard<std::mutex> guard(cache.lock);
+  return cache.entries.count(findex) != 0;
+}
+
+// record one more pending comparison of an image (if it is cached)
+void fii_pixel_cache_add_pending(fii_pixel_cache &cache,
+                                 const uint32_t findex) {
+  std::lock_guard<std::mutex> guard(cache.lock);
+  std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator it = cache.entries.find(findex);
+  if(it != cache.entries.end()) {
+    fii_pixel_cache_set_pending(cache, it, it->second.pending_count + 1);
+  }
+}
+
+void fii_pixel_cache_erase(fii_pixel_cache &cache,
+                           const uint32_t findex) {
+  std::lock_guard<std::mutex> guard(cache.lock);
+  std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator it = cache.entries.find(findex);
+  if(it != cache.entries.end()) {
+    fii_pixel_cache_erase_entry(cache, it);
+  }
+}
+
+// Once the candidate groups are known, the pending count of an image is the
+// number of comparisons it takes part in and images that are not a candidate
+// are released.
+void fii_pixel_cache_retain(fii_pixel_cache &cache,
+                            const std::vector<std::set<uint32_t> > &image_groups) {
+  std::unordered_map<uint32_t, uint32_t> comparison_count;
+  for(std::size_t group_id=0; group_id<image_groups.size(); ++group_id) {
+    std::set<uint32_t>::const_iterator si;
+    for(si=image_groups[group_id].begin(); si!=image_groups[group_id].end(); ++si) {
+      comparison_count[*si] += fii_pixel_cache_comparison_count(image_groups[group_id], *si);
+    }
+  }
+  std::lock_guard<std::mutex> guard(cache.lock);
+  cache.first_findex_of_key.clear();
+  std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator it = cache.entries.begin();
+  while(it != cache.entries.end()) {
+    std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator next = it;
+    ++next;
+    std::unordered_map<uint32_t, uint32_t>::const_iterator ci = comparison_count.find(it->first);
+    if(ci != comparison_count.end()) {
+      fii_pixel_cache_set_pending(cache, it, ci->second);
+    } else {
+      fii_pixel_cache_erase_entry(cache, it);
+    }
+    it = next;
+  }
+}
+
+// pixels of a cached image for comparison_count of its pending comparisons
+// (false if the image is not cached), the entry is released after its last
+// comparison
+bool fii_pixel_cache_take(fii_pixel_cache &cache,
+                          const uint32_t findex,
+                          std::vector<uint8_t> &pixels,
+                          const uint32_t comparison_count=1) {
+  std::lock_guard<std::mutex> guard(cache.lock);
+  std::unordered_map<uint32_t, fii_pixel_cache_entry>::iterator it = cache.entries.find(findex);
+  if(it == cache.entries.end()) {
+    return false;
+  }
+  cache.hit_count += 1;
+  if(it->second.pending_count > comparison_count) {
+    pixels = it->second.pixels;
+    fii_pixel_cache_set_pending(cache, it, it->second.pending_count - comparison_count);
+    return true;
+  }
+  pixels.swap(it->second.pixels);
+  cache.size -= pixels.size();
+  if(it->second.pending_count == 0) {
+    cache.lru.erase(it->second.lru_it);
+  } else {
+    cache.pinned.erase(std::make_pair(it->second.pending_count, findex));
+  }
+  cache.entries.erase(it);
+  return true;
+}
+
+#endif
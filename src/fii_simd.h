@@ -0,0 +1,294 @@
+/*
+  Vectorised kernels to check equality of two feature rows and to count the
+  pixel values of two images that differ by more than a tolerance. The kernel
+  is selected at runtime based on the instruction set supported by the CPU
+  (AVX-512, AVX2, SSE2) and falls back to a scalar kernel when none of these
+  are available (e.g. non-x86 platforms).
+
+  Feature rows are stored in a buffer aligned to FII_SIMD_ALIGNMENT bytes and
+  each row is padded (with zeros) to a multiple of FII_SIMD_ALIGNMENT bytes.
+  Therefore, the equality kernels do not need to handle unaligned loads or a
+  tail.
+*/
+
+#ifndef FII_SIMD_H
+#define FII_SIMD_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FII_SIMD_X86
+#include <immintrin.h>
+#endif
+
+const std::size_t FII_SIMD_ALIGNMENT = 64;
+
+template<typename T, std::size_t ALIGNMENT>
+struct fii_aligned_allocator {
+  typedef T value_type;
+  template<typename U> struct rebind {
+    typedef fii_aligned_allocator<U, ALIGNMENT> other;
+  };
+
+  fii_aligned_allocator() {}
+  template<typename U>
+  fii_aligned_allocator(const fii_aligned_allocator<U, ALIGNMENT> &) {}
+
+  T* allocate(std::size_t n) {
+    void *p = NULL;
+    if(posix_memalign(&p, ALIGNMENT, n * sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+    return (T *) p;
+  }
+  void deallocate(T *p, std::size_t) {
+    free(p);
+  }
+};
+
+template<typename T, typename U, std::size_t ALIGNMENT>
+bool operator==(const fii_aligned_allocator<T, ALIGNMENT> &,
+                const fii_aligned_allocator<U, ALIGNMENT> &) {
+  return true;
+}
+
+template<typename T, typename U, std::size_t ALIGNMENT>
+bool operator!=(const fii_aligned_allocator<T, ALIGNMENT> &,
+                const fii_aligned_allocator<U, ALIGNMENT> &) {
+  return false;
+}
+
+typedef std::vector<uint8_t, fii_aligned_allocator<uint8_t, FII_SIMD_ALIGNMENT> > fii_feature_vector;
+
+// number of bytes used to store a feature row of img_feature_count bytes
+uint32_t fii_feature_stride(const uint32_t img_feature_count) {
+  return ((img_feature_count + FII_SIMD_ALIGNMENT - 1) / FII_SIMD_ALIGNMENT) * FII_SIMD_ALIGNMENT;
+}
+
+//
+// kernels: row_size is a multiple of FII_SIMD_ALIGNMENT and a, b are aligned
+//
+bool fii_row_equal_scalar(const uint8_t *a,
+                          const uint8_t *b,
+                          const std::size_t row_size) {
+  for(std::size_t i=0; i<row_size; i+=8) {
+    uint64_t va, vb;
+    std::memcpy(&va, a + i, 8);
+    std::memcpy(&vb, b + i, 8);
+    if(va != vb) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef FII_SIMD_X86
+__attribute__((target("sse2")))
+bool fii_row_equal_sse2(const uint8_t *a,
+                        const uint8_t *b,
+                        const std::size_t row_size) {
+  for(std::size_t i=0; i<row_size; i+=32) {
+    __m128i a0 = _mm_load_si128((const __m128i *) (a + i));
+    __m128i a1 = _mm_load_si128((const __m128i *) (a + i + 16));
+    __m128i b0 = _mm_load_si128((const __m128i *) (b + i));
+    __m128i b1 = _mm_load_si128((const __m128i *) (b + i + 16));
+    __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(a0, b0), _mm_cmpeq_epi8(a1, b1));
+    if(_mm_movemask_epi8(eq) != 0xFFFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+__attribute__((target("avx2")))
+bool fii_row_equal_avx2(const uint8_t *a,
+                        const uint8_t *b,
+                        const std::size_t row_size) {
+  for(std::size_t i=0; i<row_size; i+=64) {
+    __m256i d0 = _mm256_xor_si256(_mm256_load_si256((const __m256i *) (a + i)),
+                                  _mm256_load_si256((const __m256i *) (b + i)));
+    __m256i d1 = _mm256_xor_si256(_mm256_load_si256((const __m256i *) (a + i + 32)),
+                                  _mm256_load_si256((const __m256i *) (b + i + 32)));
+    __m256i d = _mm256_or_si256(d0, d1);
+    if(!_mm256_testz_si256(d, d)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+__attribute__((target("avx512f")))
+bool fii_row_equal_avx512(const uint8_t *a,
+                          const uint8_t *b,
+                          const std::size_t row_size) {
+  for(std::size_t i=0; i<row_size; i+=64) {
+    __m512i va = _mm512_load_si512((const void *) (a + i));
+    __m512i vb = _mm512_load_si512((const void *) (b + i));
+    // bytes are equal iff all 64 bit lanes are equal
+    if(_mm512_cmpneq_epi64_mask(va, vb) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
+typedef bool (*fii_row_equal_kernel)(const uint8_t *, const uint8_t *, const std::size_t);
+
+fii_row_equal_kernel fii_select_row_equal_kernel(const char **kernel_name=NULL) {
+  fii_row_equal_kernel kernel = fii_row_equal_scalar;
+  const char *name = "scalar";
+#ifdef FII_SIMD_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) {
+    kernel = fii_row_equal_avx512;
+    name = "avx512";
+  } else if(__builtin_cpu_supports("avx2")) {
+    kernel = fii_row_equal_avx2;
+    name = "avx2";
+  } else if(__builtin_cpu_supports("sse2")) {
+    kernel = fii_row_equal_sse2;
+    name = "sse2";
+  }
+#endif
+  if(kernel_name) {
+    *kernel_name = name;
+  }
+  return kernel;
+}
+
+// equality of two feature rows using the best kernel for this CPU
+bool fii_row_equal(const uint8_t *a,
+                   const uint8_t *b,
+                   const std::size_t row_size) {
+  static const fii_row_equal_kernel kernel = fii_select_row_equal_kernel();
+  return kernel(a, b, row_size);
+}
+
+//
+// kernels to count the number of values whose absolute difference exceeds
+// max_diff. Counting stops early (and returns a value greater than budget)
+// once more than budget values differ. a, b need not be aligned or padded.
+//
+uint64_t fii_count_diff_scalar(const uint8_t *a,
+                               const uint8_t *b,
+                               const std::size_t size,
+                               const uint8_t max_diff,
+                               const uint64_t budget) {
+  uint64_t count = 0;
+  for(std::size_t i=0; i<size; ++i) {
+    int diff = ((int) a[i]) - ((int) b[i]);
+    if(diff > max_diff || -diff > max_diff) {
+      count += 1;
+      if(count > budget) {
+        return count;
+      }
+    }
+  }
+  return count;
+}
+
+#ifdef FII_SIMD_X86
+__attribute__((target("sse2")))
+uint64_t fii_count_diff_sse2(const uint8_t *a,
+                             const uint8_t *b,
+                             const std::size_t size,
+                             const uint8_t max_diff,
+                             const uint64_t budget) {
+  const __m128i t = _mm_set1_epi8((char) max_diff);
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t count = 0;
+  std::size_t i = 0;
+  for(; i + 16 <= size; i+=16) {
+    __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+    __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+    // values within max_diff are zero after saturated subtraction
+    int within = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(d, t), zero));
+    count += 16 - __builtin_popcount(within);
+    if(count > budget) {
+      return count;
+    }
+  }
+  return count + fii_count_diff_scalar(a + i, b + i, size - i, max_diff, budget - count);
+}
+
+__attribute__((target("avx2")))
+uint64_t fii_count_diff_avx2(const uint8_t *a,
+                             const uint8_t *b,
+                             const std::size_t size,
+                             const uint8_t max_diff,
+                             const uint64_t budget) {
+  const __m256i t = _mm256_set1_epi8((char) max_diff);
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t count = 0;
+  std::size_t i = 0;
+  for(; i + 32 <= size; i+=32) {
+    __m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *) (b + i));
+    __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+    uint32_t within = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(d, t), zero));
+    count += 32 - __builtin_popcount(within);
+    if(count > budget) {
+      return count;
+    }
+  }
+  return count + fii_count_diff_scalar(a + i, b + i, size - i, max_diff, budget - count);
+}
+
+__attribute__((target("avx512bw")))
+uint64_t fii_count_diff_avx512(const uint8_t *a,
+                               const uint8_t *b,
+                               const std::size_t size,
+                               const uint8_t max_diff,
+                               const uint64_t budget) {
+  const __m512i t = _mm512_set1_epi8((char) max_diff);
+  uint64_t count = 0;
+  std::size_t i = 0;
+  for(; i + 64 <= size; i+=64) {
+    __m512i va = _mm512_loadu_si512((const void *) (a + i));
+    __m512i vb = _mm512_loadu_si512((const void *) (b + i));
+    __m512i d = _mm512_or_si512(_mm512_subs_epu8(va, vb), _mm512_subs_epu8(vb, va));
+    count += __builtin_popcountll(_mm512_cmpgt_epu8_mask(d, t));
+    if(count > budget) {
+      return count;
+    }
+  }
+  return count + fii_count_diff_scalar(a + i, b + i, size - i, max_diff, budget - count);
+}
+#endif
+
+typedef uint64_t (*fii_count_diff_kernel)(const uint8_t *, const uint8_t *, const std::size_t,
+                                          const uint8_t, const uint64_t);
+
+fii_count_diff_kernel fii_select_count_diff_kernel() {
+  fii_count_diff_kernel kernel = fii_count_diff_scalar;
+#ifdef FII_SIMD_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512bw")) {
+    kernel = fii_count_diff_avx512;
+  } else if(__builtin_cpu_supports("avx2")) {
+    kernel = fii_count_diff_avx2;
+  } else if(__builtin_cpu_supports("sse2")) {
+    kernel = fii_count_diff_sse2;
+  }
+#endif
+  return kernel;
+}
+
+// number of values (see above) that differ using the best kernel for this CPU
+uint64_t fii_count_diff(const uint8_t *a,
+                        const uint8_t *b,
+                        const std::size_t size,
+                        const uint8_t max_diff,
+                        const uint64_t budget) {
+  static const fii_count_diff_kernel kernel = fii_select_count_diff_kernel();
+  return kernel(a, b, size, max_diff, budget);
+}
+
+#endif
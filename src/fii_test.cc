@@ -1,13 +1,26 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <set>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <random>
 #include <fstream>
+#include <algorithm>
+#include <unistd.h>
+
+#include "omp.h"
 
 #include "fii_util.h"
 #include "fii_image_size.h"
+#include "fii_export.h"
+#include "fii.h"
+#include "fii_hash.h"
+#include "fii_union_find.h"
+#include "fii_simd.h"
+#include "fii_bloom_filter.h"
+#include "fii_pixel_cache.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -186,6 +199,54 @@ int create_dir_with_identical_img(const std::string dir1,
   return EXIT_SUCCESS;
 }
 
+int copy_files(const std::string src_dir,
+               const std::string dst_dir,
+               const std::vector<std::string> &filename_list) {
+  for(std::size_t i=0; i<filename_list.size(); ++i) {
+    std::ifstream fin(src_dir + filename_list[i], std::ios::binary);
+    std::ofstream fout(dst_dir + filename_list[i], std::ios::binary);
+    fout << fin.rdbuf();
+    if(!fin || !fout) {
+      std::cout << "failed to copy " << src_dir + filename_list[i]
+                << " to " << dst_dir << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// run fii and check that its output contains each of the expected messages
+// and none of the unexpected messages
+int test_fii_output(const std::string test_id,
+                    const std::string args,
+                    const std::vector<std::string> &expected_messages,
+                    const std::vector<std::string> &unexpected_messages=std::vector<std::string>()) {
+  std::string log_filename = fii::create_testdir("fii_test_log") + "fii_test.log";
+  std::string cmd = "./fii " + args + " > " + log_filename;
+  std::cout << "==[ " << test_id << ": " << cmd << std::endl;
+  std::string log;
+  if(system(cmd.c_str()) != 0 || !fii::fs_load_file(log_filename, log)) {
+    std::cerr << "failed to execute the following command"
+              << std::endl << cmd << std::endl;
+    return EXIT_FAILURE;
+  }
+  for(std::size_t i=0; i<expected_messages.size(); ++i) {
+    if(log.find(expected_messages[i]) == std::string::npos) {
+      std::cerr << test_id << " : missing message \"" << expected_messages[i]
+                << "\" in the output" << std::endl << log << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  for(std::size_t i=0; i<unexpected_messages.size(); ++i) {
+    if(log.find(unexpected_messages[i]) != std::string::npos) {
+      std::cerr << test_id << " : unexpected message \"" << unexpected_messages[i]
+                << "\" in the output" << std::endl << log << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
 int test_fii_on_dir(const std::string test_id,
                     const std::string dir1,
                     const std::string args,
@@ -252,11 +313,314 @@ int test_fii_on_dir(const std::string test_id,
   }
   return EXIT_SUCCESS;
 }
+// fii_hash128() must be MurmurHash3_x64_128() such that the keys used to
+// partition the feature rows remain same across versions: the hash of the
+// hashes of keys {}, {0}, {0,1}, ..., {0,...,254} (with seed 256 - key length)
+// is the verification value of SMHasher
+int test_hash() {
+  uint8_t key[256];
+  uint8_t hashes[256 * 16];
+  for(uint32_t i=0; i<256; ++i) {
+    key[i] = i;
+    uint64_t hash[2];
+    fii_hash128(key, i, 256 - i, hash);
+    std::memcpy(hashes + i * 16, hash, 16);
+  }
+  uint64_t hash[2];
+  fii_hash128(hashes, sizeof(hashes), 0, hash);
+  uint32_t verification = (uint32_t) hash[0];
+  if(verification != 0x6384BA69) {
+    std::cerr << "hash : unexpected verification value " << std::hex
+              << verification << std::dec << std::endl;
+    return EXIT_FAILURE;
+  }
+  // rows that differ in a single value have different keys
+  std::vector<uint8_t> row(225, 7);
+  uint64_t row_key = fii_hash64(row.data(), row.size());
+  row[224] = 8;
+  if(fii_hash64(row.data(), row.size()) == row_key) {
+    std::cerr << "hash : rows differing in one value have the same key" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// edges merged concurrently (in a random order) by all threads give the same
+// groups as the connected components of the match graph. Node i < 9000 is
+// connected to node i - 100 and therefore, belongs to group i % 100 while
+// the remaining nodes are not connected to any other node.
+int test_union_find() {
+  const uint32_t node_count = 10000;
+  const uint32_t group_count = 100;
+  const uint32_t connected_count = 9000;
+  std::vector<std::pair<uint32_t, uint32_t> > edges;
+  for(uint32_t i=group_count; i<connected_count; ++i) {
+    edges.push_back(std::make_pair(i, i - group_count));
+  }
+  std::mt19937 rand_gen(4099);
+  std::shuffle(edges.begin(), edges.end(), rand_gen);
+
+  fii_union_find uf;
+  fii_union_find_init(uf, node_count);
+  // more threads than cores such that merges interleave on any machine
+#pragma omp parallel for num_threads(8)
+  for(std::size_t ei=0; ei<edges.size(); ++ei) {
+    fii_union_find_merge(uf, edges[ei].first, edges[ei].second);
+  }
+  std::vector<uint32_t> node_id(node_count);
+  for(uint32_t i=0; i<node_count; ++i) {
+    node_id[i] = 2 * i;
+  }
+  std::vector<std::set<uint32_t> > groups;
+  fii_union_find_groups(uf, node_id, groups);
+  if(groups.size() != group_count) {
+    std::cerr << "union-find : expected " << group_count << " groups, found "
+              << groups.size() << std::endl;
+    return EXIT_FAILURE;
+  }
+  for(uint32_t g=0; g<group_count; ++g) {
+    // groups are ordered by their representative (i.e. smallest node)
+    std::set<uint32_t> expected_group;
+    for(uint32_t i=g; i<connected_count; i+=group_count) {
+      expected_group.insert(2 * i);
+    }
+    if(groups[g] != expected_group) {
+      std::cerr << "union-find : unexpected members of group " << g << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// each vectorised kernel supported by this CPU must give the same result as
+// the scalar kernel: equality of padded feature rows differing in any one
+// byte and the number of values differing by more than max_diff (for sizes
+// with a tail, unaligned values and an early exit after the budget)
+int test_simd_kernels() {
+  std::vector<std::pair<std::string, fii_row_equal_kernel> > row_equal_kernels;
+  std::vector<std::pair<std::string, fii_count_diff_kernel> > count_diff_kernels;
+  row_equal_kernels.push_back(std::make_pair("scalar", fii_row_equal_scalar));
+  count_diff_kernels.push_back(std::make_pair("scalar", fii_count_diff_scalar));
+#ifdef FII_SIMD_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse2")) {
+    row_equal_kernels.push_back(std::make_pair("sse2", fii_row_equal_sse2));
+    count_diff_kernels.push_back(std::make_pair("sse2", fii_count_diff_sse2));
+  }
+  if(__builtin_cpu_supports("avx2")) {
+    row_equal_kernels.push_back(std::make_pair("avx2", fii_row_equal_avx2));
+    count_diff_kernels.push_back(std::make_pair("avx2", fii_count_diff_avx2));
+  }
+  if(__builtin_cpu_supports("avx512f")) {
+    row_equal_kernels.push_back(std::make_pair("avx512", fii_row_equal_avx512));
+  }
+  if(__builtin_cpu_supports("avx512bw")) {
+    count_diff_kernels.push_back(std::make_pair("avx512", fii_count_diff_avx512));
+  }
+#endif
+
+  std::mt19937 rand_gen(5003);
+  std::uniform_int_distribution<> rand_value(0, 255);
+  uint32_t stride = fii_feature_stride(225);
+  fii_feature_vector rows(2 * stride);
+  for(uint32_t trial=0; trial<=stride; ++trial) {
+    for(uint32_t i=0; i<stride; ++i) {
+      rows[i] = rand_value(rand_gen);
+      rows[stride + i] = rows[i];
+    }
+    if(trial < stride) {
+      rows[stride + trial] ^= 1 + (rand_value(rand_gen) % 255); // one byte differs
+    }
+    bool is_equal = fii_row_equal_scalar(&rows[0], &rows[stride], stride);
+    if(is_equal != (trial == stride)) {
+      std::cerr << "simd : scalar row equality failed" << std::endl;
+      return EXIT_FAILURE;
+    }
+    for(std::size_t k=1; k<row_equal_kernels.size(); ++k) {
+      if(row_equal_kernels[k].second(&rows[0], &rows[stride], stride) != is_equal) {
+        std::cerr << "simd : " << row_equal_kernels[k].first
+                  << " row equality differs from scalar kernel" << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  std::uniform_int_distribution<> rand_noise(-4, 4);
+  std::vector<uint8_t> a(1 + 1037), b(1 + 1037);
+  for(std::size_t i=0; i<a.size(); ++i) {
+    a[i] = rand_value(rand_gen);
+    b[i] = std::min(std::max(((int) a[i]) + rand_noise(rand_gen), 0), 255);
+  }
+  std::size_t size_list[] = { 1, 15, 16, 33, 64, 127, 1037 };
+  uint8_t max_diff_list[] = { 0, 2, 3 };
+  uint64_t budget_list[] = { 0, 10, 1037 };
+  for(std::size_t si=0; si<7; ++si) {
+    for(std::size_t mi=0; mi<3; ++mi) {
+      for(std::size_t bi=0; bi<3; ++bi) {
+        // values start at an unaligned address
+        uint64_t count = fii_count_diff_scalar(&a[1], &b[1], size_list[si],
+                                               max_diff_list[mi], budget_list[bi]);
+        for(std::size_t k=1; k<count_diff_kernels.size(); ++k) {
+          uint64_t kernel_count = count_diff_kernels[k].second(&a[1], &b[1], size_list[si],
+                                                               max_diff_list[mi], budget_list[bi]);
+          // counting may stop at any value greater than the budget
+          bool is_same = (count > budget_list[bi]) ? (kernel_count > budget_list[bi]) : (kernel_count == count);
+          if(!is_same) {
+            std::cerr << "simd : " << count_diff_kernels[k].first
+                      << " count of differing values (" << kernel_count
+                      << ") differs from scalar kernel (" << count << ")" << std::endl;
+            return EXIT_FAILURE;
+          }
+        }
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// the sampled pixel locations (and colour channels) must be those that vary
+// in the sample images: only a block of 16x16 pixels at (32,10) varies while
+// all other pixels are same in all the sample images
+int test_adaptive_sampling() {
+  std::string dir = fii::create_testdir("fii_test_sampling");
+  int width = 64;
+  int height = 48;
+  int nchannel = 3;
+  std::mt19937 rand_gen(8191);
+  std::uniform_int_distribution<> rand_pixel(0, 255);
+  std::vector<std::string> sample_path_list;
+  for(uint32_t i=0; i<FII_ADAPTIVE_SAMPLING_IMG_COUNT; ++i) {
+    std::vector<uint8_t> image_data(width * height * nchannel, 128);
+    for(int y=10; y<26; ++y) {
+      for(int x=32; x<48; ++x) {
+        for(int c=0; c<nchannel; ++c) {
+          image_data[(y * width + x) * nchannel + c] = rand_pixel(rand_gen);
+        }
+      }
+    }
+    std::ostringstream filename;
+    filename << dir << "fii_test_sample_" << i << ".png";
+    if(!stbi_write_png(filename.str().c_str(), width, height, nchannel, image_data.data(), width * nchannel)) {
+      std::cerr << "failed to write adaptive sampling test images" << std::endl;
+      return EXIT_FAILURE;
+    }
+    sample_path_list.push_back(filename.str());
+  }
+
+  std::vector<uint32_t> img_dim = { (uint32_t) width, (uint32_t) height, (uint32_t) nchannel };
+  std::unordered_map<std::string, std::string> options;
+  fii_feature_layout layout;
+  fii_init_feature_layout(img_dim, options, layout);
+  fii_init_adaptive_sampling(sample_path_list, img_dim, layout);
+  fii::remove_testdir("fii_test_sampling");
+  if(layout.sample_unit != 1 || layout.sample_offset.size() != layout.sparse_feature_count) {
+    std::cerr << "adaptive-sampling : expected " << layout.sparse_feature_count
+              << " sampled values, found " << layout.sample_offset.size() << std::endl;
+    return EXIT_FAILURE;
+  }
+  for(std::size_t i=0; i<layout.sample_offset.size(); ++i) {
+    uint64_t x = (layout.sample_offset[i] / nchannel) % width;
+    uint64_t y = (layout.sample_offset[i] / nchannel) / width;
+    if(x < 32 || x >= 48 || y < 10 || y >= 26) {
+      std::cerr << "adaptive-sampling : sampled a uniform pixel at ("
+                << x << "," << y << ")" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// entries of a pixel cache (with a budget of 3 images of 100 bytes) are
+// evicted by their number of pending comparisons and released by the last one
+int test_pixel_cache() {
+  fii_pixel_cache cache;
+  fii_pixel_cache_init(cache, 300);
+  std::vector<uint8_t> pixels;
+  uint32_t put_list[][2] = { {1, 0}, {2, 0}, {3, 2}, {4, 0}, {5, 1}, {6, 3} };
+  for(std::size_t i=0; i<6; ++i) {
+    pixels.assign(100, put_list[i][0]);
+    if(!fii_pixel_cache_put(cache, put_list[i][0], pixels, put_list[i][1])) {
+      std::cerr << "pixel-cache : failed to put image " << put_list[i][0] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  // images 1, 2 and 4 without pending comparison were evicted first
+  if(cache.eviction_count != 3 || cache.size != 300 ||
+     fii_pixel_cache_contains(cache, 1) || fii_pixel_cache_contains(cache, 2) ||
+     fii_pixel_cache_contains(cache, 4) || !fii_pixel_cache_contains(cache, 5)) {
+    std::cerr << "pixel-cache : unexpected eviction of images without pending comparison"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  // an image only evicts images with fewer pending comparisons
+  pixels.assign(100, 7);
+  if(fii_pixel_cache_put(cache, 7, pixels, 1)) {
+    std::cerr << "pixel-cache : image 7 evicted an image with as many pending comparisons"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  pixels.assign(100, 8);
+  if(!fii_pixel_cache_put(cache, 8, pixels, 2) || fii_pixel_cache_contains(cache, 5)) {
+    std::cerr << "pixel-cache : image 8 did not evict image 5" << std::endl;
+    return EXIT_FAILURE;
+  }
+  // image 3 is released by the last of its 2 comparisons
+  if(!fii_pixel_cache_take(cache, 3, pixels) || pixels != std::vector<uint8_t>(100, 3) ||
+     !fii_pixel_cache_contains(cache, 3)) {
+    std::cerr << "pixel-cache : image 3 released before its last comparison" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if(!fii_pixel_cache_take(cache, 3, pixels) || fii_pixel_cache_contains(cache, 3) ||
+     cache.size != 200 || cache.hit_count != 2 || fii_pixel_cache_take(cache, 3, pixels)) {
+    std::cerr << "pixel-cache : image 3 not released after its last comparison" << std::endl;
+    return EXIT_FAILURE;
+  }
+  // the first image of a key is compared with each later image of the key
+  fii_pixel_cache_init(cache, 300);
+  for(uint32_t findex=10; findex<13; ++findex) {
+    pixels.assign(100, findex);
+    fii_pixel_cache_put_keyed(cache, findex, 1, pixels);
+  }
+  std::vector<std::set<uint32_t> > image_groups(1);
+  image_groups[0].insert(10);
+  image_groups[0].insert(11);
+  fii_pixel_cache_retain(cache, image_groups);
+  if(fii_pixel_cache_contains(cache, 12) ||
+     !fii_pixel_cache_take(cache, 11, pixels) || fii_pixel_cache_contains(cache, 11) ||
+     !fii_pixel_cache_take(cache, 10, pixels) || fii_pixel_cache_contains(cache, 10) ||
+     cache.size != 0) {
+    std::cerr << "pixel-cache : candidate group not released after its comparisons"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
 int main(int argc, char **argv) {
   int success = 0;
   fii::init_homedir_and_subdirs();
 
+  success = test_hash();
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_union_find();
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_simd_kernels();
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_adaptive_sampling();
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_pixel_cache();
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
   std::string dir1 = fii::create_testdir("fii_test_dir1");
   std::string dir2 = fii::create_testdir("fii_test_dir2");
   std::string dir3 = fii::create_testdir("fii_test_dir3");
@@ -310,14 +674,36 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
-  // test on two folders (same dir1) resulting in all identical images
-  success = test_fii_on_dir("dir1-dir1-all-identical",
+  // test on a single folder containing 3 identical images (all verification tiers)
+  success = test_fii_on_dir("dir3-3-identical-tiers",
+                            dir3,
+                            "--check-tiers=grid,rowhash,hash,exact ",
+                            dir3_3_identical);
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on a single folder containing 3 identical images (sparse pixel
+  // values sampled on a different grid)
+  success = test_fii_on_dir("dir3-3-identical-sample-grid",
+                            dir3,
+                            "--sample-grid=8 ",
+                            dir3_3_identical);
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if(system(("./fii --sample-grid=8x " + dir3).c_str()) == 0) {
+    std::cerr << "dir3-3-identical-sample-grid : invalid grid size was accepted"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // test on two folders (same dir1) processed as a single folder
+  // containing no identical images
+  success = test_fii_on_dir("dir1-dir1-self-join",
                             dir1,
                             "",
-                            {
-                             {"fii_test_dir1-fii_test_dir1-identical.json", 5377},
-                             {"fii_test_dir1-fii_test_dir1-identical.csv",  4930},
-                            },
+                            {},
                             dir1);
   if(success != EXIT_SUCCESS) {
     return EXIT_FAILURE;
@@ -333,7 +719,37 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
-  // test on two folders (same dir1) resulting in all identical images
+  // test on two folders (same dir2) processed as a single folder
+  // containing no identical images (exhaustive pixel search)
+  success = test_fii_on_dir("dir2-dir2-self-join-exhaustive",
+                            dir2,
+                            "--check-all-pixels ",
+                            {},
+                            dir2);
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on two folders, each being a copy of the other stored in a different
+  // path (with same folder name), resulting in all identical images
+  fii::create_testdir("fii_test_copy");
+  std::string dir1_copy = fii::create_testdir("fii_test_copy/fii_test_dir1");
+  std::string dir2_copy = fii::create_testdir("fii_test_copy/fii_test_dir2");
+  if(copy_files(dir1, dir1_copy, filename_list1) != EXIT_SUCCESS ||
+     copy_files(dir2, dir2_copy, filename_list2) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir1-dir1-all-identical",
+                            dir1,
+                            "",
+                            {
+                             {"fii_test_dir1-fii_test_dir1-identical.json", 5377},
+                             {"fii_test_dir1-fii_test_dir1-identical.csv",  4930},
+                            },
+                            dir1_copy);
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
   success = test_fii_on_dir("dir2-dir2-all-identical-exhaustive",
                             dir2,
                             "--check-all-pixels ",
@@ -341,7 +757,456 @@ int main(int argc, char **argv) {
                              {"fii_test_dir2-fii_test_dir2-identical.json", 5415},
                              {"fii_test_dir2-fii_test_dir2-identical.csv",  4968},
                             },
+                            dir2_copy);
+  fii::remove_testdir("fii_test_copy/fii_test_dir1");
+  fii::remove_testdir("fii_test_copy/fii_test_dir2");
+  fii::remove_testdir("fii_test_copy");
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on three folders resulting in 0 identical image between folders,
+  // identical images within dir3 are only reported in the leakage matrix
+  success = test_fii_on_dir("dir1-dir2-dir3-leakage",
+                            dir1,
+                            "",
+                            {
+                             {"fii_test_dir1-fii_test_dir2-fii_test_dir3-leakage.csv", 123},
+                            },
+                            dir2 + " " + dir3);
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on two folders using a saved filter of dir2: the filter is saved by
+  // the first run, loaded by the second run and rebuilt when dir2 changes
+  std::string filter_dir = fii::create_testdir("fii_test_filter");
+  std::string filter_filename = filter_dir + "fii_test_dir2.filter";
+  std::string filter_args = "--dir2-filter=" + filter_filename + " ";
+  success = test_fii_on_dir("dir1-dir2-filter-save", dir1, filter_args, {}, dir2);
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  std::unordered_map<std::string, fii_bloom_filter> filters2;
+  if(!fii_bloom_filter_load(filter_filename, filters2) || filters2.size() == 0) {
+    std::cerr << "dir1-dir2-filter-save : failed to load saved filter" << std::endl;
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir1-dir2-filter-load", dir1, filter_args, {}, dir2);
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  {
+    // a truncated filter file must be rejected
+    std::string filter_bytes;
+    fii::fs_load_file(filter_filename, filter_bytes);
+    std::string truncated_filename = filter_dir + "fii_test_truncated.filter";
+    std::ofstream fout(truncated_filename, std::ios::binary);
+    fout.write(filter_bytes.data(), filter_bytes.size() - 1);
+    fout.close();
+    bool is_loaded = fii_bloom_filter_load(truncated_filename, filters2);
+    std::remove(truncated_filename.c_str());
+    if(is_loaded) {
+      std::cerr << "dir1-dir2-filter-load : truncated filter was loaded" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::string filter_copy_filename = dir2 + "fii_test_filter_copy-" + filename_list1[1];
+  {
+    std::ifstream fin(dir1 + filename_list1[1], std::ios::binary);
+    std::ofstream fout(filter_copy_filename, std::ios::binary);
+    fout << fin.rdbuf();
+  }
+  success = test_fii_on_dir("dir1-dir2-filter-rebuild",
+                            dir1,
+                            filter_args,
+                            {
+                             {"fii_test_dir1-fii_test_dir2-identical.json", 151},
+                             {"fii_test_dir1-fii_test_dir2-identical.csv",  119},
+                            },
                             dir2);
+  std::remove(filter_copy_filename.c_str());
+  fii::remove_testdir("fii_test_filter");
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on a folder and its subfolder, both containing a copy of an image,
+  // every image file is decoded only once and does not match itself
+  std::string dir4 = fii::create_testdir("fii_test_dir4");
+  std::string dir5 = fii::create_testdir("fii_test_dir4/fii_test_dir5");
+  std::vector<std::string> dst_dir_list = {dir4, dir5, dir5};
+  for(std::size_t i=0; i<dst_dir_list.size(); ++i) {
+    std::string src_filename = dir3 + filename_list3[i / 2];
+    std::string dst_filename = dst_dir_list[i] + filename_list3[i / 2];
+    std::ifstream fin(src_filename, std::ios::binary);
+    std::ofstream fout(dst_filename, std::ios::binary);
+    fout << fin.rdbuf();
+    fin.close();
+    fout.close();
+  }
+  success = test_fii_on_dir("dir4-dir5-nested",
+                            dir4,
+                            "",
+                            {
+                             {"fii_test_dir4-fii_test_dir5-identical.json", 197},
+                             {"fii_test_dir4-fii_test_dir5-identical.csv",  164},
+                             {"fii_test_dir4-fii_test_dir5-leakage.csv",    81},
+                            },
+                            dir5);
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on a folder containing an image and its crop
+  std::string dir6 = fii::create_testdir("fii_test_dir6");
+  {
+    std::mt19937 rand_gen(9973);
+    std::uniform_int_distribution<> rand_pixel(0, 255);
+    int width = 64;
+    int height = 48;
+    int nchannel = 3;
+    std::vector<uint8_t> image_data(width * height * nchannel);
+    for(std::size_t px=0; px<image_data.size(); ++px) {
+      image_data[px] = rand_pixel(rand_gen);
+    }
+    int crop_x = 7;
+    int crop_y = 5;
+    int crop_width = 20;
+    int crop_height = 16;
+    std::vector<uint8_t> crop_data;
+    for(int y=crop_y; y<(crop_y + crop_height); ++y) {
+      std::vector<uint8_t>::const_iterator row = image_data.begin() + (y * width + crop_x) * nchannel;
+      crop_data.insert(crop_data.end(), row, row + crop_width * nchannel);
+    }
+    std::string img_filename = dir6 + "fii_test_img.png";
+    std::string crop_filename = dir6 + "fii_test_crop.png";
+    if(!stbi_write_png(img_filename.c_str(), width, height, nchannel, image_data.data(), width * nchannel) ||
+       !stbi_write_png(crop_filename.c_str(), crop_width, crop_height, nchannel, crop_data.data(), crop_width * nchannel)) {
+      std::cerr << "failed to write crop test images" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  success = test_fii_on_dir("dir6-crop",
+                            dir6,
+                            "--find-crops ",
+                            {
+                             {"fii_test_dir6-crops.csv", 89},
+                            });
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on a folder containing an image and its copy whose pixel values
+  // differ by at most 2 (e.g. a lossy copy), block averages of the image are
+  // far from a quantisation level of the coarse signature
+  std::string dir7 = fii::create_testdir("fii_test_dir7");
+  {
+    std::mt19937 rand_gen(7919);
+    std::uniform_int_distribution<> rand_pixel(64, 127);
+    std::uniform_int_distribution<> rand_noise(-2, 2);
+    int width = 64;
+    int height = 48;
+    int nchannel = 3;
+    std::vector<uint8_t> image_data(width * height * nchannel);
+    std::vector<uint8_t> perturbed_data(image_data.size());
+    for(std::size_t px=0; px<image_data.size(); ++px) {
+      image_data[px] = rand_pixel(rand_gen);
+      perturbed_data[px] = image_data[px] + rand_noise(rand_gen);
+    }
+    std::string img_filename = dir7 + "fii_test_img.png";
+    std::string perturbed_filename = dir7 + "fii_test_perturbed.png";
+    if(!stbi_write_png(img_filename.c_str(), width, height, nchannel, image_data.data(), width * nchannel) ||
+       !stbi_write_png(perturbed_filename.c_str(), width, height, nchannel, perturbed_data.data(), width * nchannel)) {
+      std::cerr << "failed to write perturbed test images" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  success = test_fii_on_dir("dir7-perturbed-exhaustive",
+                            dir7,
+                            "--check-all-pixels ",
+                            {});
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir7-perturbed-tolerance",
+                            dir7,
+                            "--max-pixel-diff=2 ",
+                            {
+                             {"fii_test_dir7-identical.json", 105},
+                             {"fii_test_dir7-identical.csv",  72},
+                            });
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir7-perturbed-near-identical",
+                            dir7,
+                            "--near-identical ",
+                            {
+                             {"fii_test_dir7-identical.json",     121},
+                             {"fii_test_dir7-near-identical.csv", 72},
+                            });
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if(system(("./fii --near-identical --hamming-radius=6x " + dir7).c_str()) == 0) {
+    std::cerr << "dir7-perturbed-near-identical : invalid hamming radius was accepted"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // test on a folder containing an image and its copy downscaled to half of
+  // its width and height by averaging blocks of 2x2 pixels
+  std::string dir8 = fii::create_testdir("fii_test_dir8");
+  {
+    std::mt19937 rand_gen(6007);
+    std::uniform_int_distribution<> rand_noise(0, 15);
+    int width = 64;
+    int height = 48;
+    int nchannel = 3;
+    std::vector<uint8_t> image_data(width * height * nchannel);
+    for(int y=0; y<height; ++y) {
+      for(int x=0; x<width; ++x) {
+        for(int c=0; c<nchannel; ++c) {
+          int value = (c == 0 ? 3 * x : (c == 1 ? 4 * y : 2 * (x + y))) + rand_noise(rand_gen);
+          image_data[(y * width + x) * nchannel + c] = std::min(value, 255);
+        }
+      }
+    }
+    int half_width = width / 2;
+    int half_height = height / 2;
+    std::vector<uint8_t> half_data(half_width * half_height * nchannel);
+    for(int y=0; y<half_height; ++y) {
+      for(int x=0; x<half_width; ++x) {
+        for(int c=0; c<nchannel; ++c) {
+          int sum = 0;
+          for(int dy=0; dy<2; ++dy) {
+            for(int dx=0; dx<2; ++dx) {
+              sum += image_data[((2 * y + dy) * width + (2 * x + dx)) * nchannel + c];
+            }
+          }
+          half_data[(y * half_width + x) * nchannel + c] = (sum + 2) / 4;
+        }
+      }
+    }
+    std::string img_filename = dir8 + "fii_test_img.png";
+    std::string half_filename = dir8 + "fii_test_half.png";
+    if(!stbi_write_png(img_filename.c_str(), width, height, nchannel, image_data.data(), width * nchannel) ||
+       !stbi_write_png(half_filename.c_str(), half_width, half_height, nchannel, half_data.data(), half_width * nchannel)) {
+      std::cerr << "failed to write resized test images" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  success = test_fii_on_dir("dir8-resized",
+                            dir8,
+                            "--find-resized ",
+                            {
+                             {"fii_test_dir8-resized.csv", 67},
+                            });
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on a folder containing an image, its copy and a truncated copy whose
+  // header is intact, the truncated copy is discarded before being decoded
+  std::string dir9 = fii::create_testdir("fii_test_dir9");
+  {
+    std::mt19937 rand_gen(3301);
+    std::uniform_int_distribution<> rand_pixel(0, 255);
+    int width = 64;
+    int height = 48;
+    int nchannel = 3;
+    std::vector<uint8_t> image_data(width * height * nchannel);
+    for(std::size_t px=0; px<image_data.size(); ++px) {
+      image_data[px] = rand_pixel(rand_gen);
+    }
+    std::string img_filename = dir9 + "fii_test_img.png";
+    std::string copy_filename = dir9 + "fii_test_copy.png";
+    if(!stbi_write_png(img_filename.c_str(), width, height, nchannel, image_data.data(), width * nchannel) ||
+       !stbi_write_png(copy_filename.c_str(), width, height, nchannel, image_data.data(), width * nchannel)) {
+      std::cerr << "failed to write truncated test images" << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::string img_data;
+    fii::fs_load_file(img_filename, img_data);
+    std::ofstream f(dir9 + "fii_test_truncated.png", std::ios::binary);
+    f.write(img_data.data(), img_data.size() / 2);
+  }
+  success = test_fii_output("dir9-truncated-output",
+                            dir9,
+                            {"Discarded 1 malformed images"},
+                            {"could not be decoded"});
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir9-truncated",
+                            dir9,
+                            "",
+                            {
+                             {"fii_test_dir9-identical.json", 100},
+                             {"fii_test_dir9-identical.csv",  67},
+                            });
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on a folder containing an image, its byte identical copy and a copy
+  // encoded in another format, the byte identical copy is not decoded
+  std::string dir10 = fii::create_testdir("fii_test_dir10");
+  {
+    std::mt19937 rand_gen(2411);
+    std::uniform_int_distribution<> rand_pixel(0, 255);
+    int width = 64;
+    int height = 48;
+    int nchannel = 3;
+    std::vector<uint8_t> image_data(width * height * nchannel);
+    for(std::size_t px=0; px<image_data.size(); ++px) {
+      image_data[px] = rand_pixel(rand_gen);
+    }
+    std::string img_filename = dir10 + "fii_test_img.png";
+    std::string bmp_filename = dir10 + "fii_test_img.bmp";
+    if(!stbi_write_png(img_filename.c_str(), width, height, nchannel, image_data.data(), width * nchannel) ||
+       !stbi_write_bmp(bmp_filename.c_str(), width, height, nchannel, image_data.data())) {
+      std::cerr << "failed to write byte identical test images" << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::ifstream fin(img_filename, std::ios::binary);
+    std::ofstream fout(dir10 + "fii_test_copy.png", std::ios::binary);
+    fout << fin.rdbuf();
+  }
+  success = test_fii_output("dir10-byte-identical-output",
+                            dir10,
+                            {"Found 1 byte identical copies of image files (not decoded).",
+                             "found 2 identical images"});
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir10-byte-identical",
+                            dir10,
+                            "",
+                            {
+                             {"fii_test_dir10-identical.json", 136},
+                             {"fii_test_dir10-identical.csv",  103},
+                            });
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // a hardlink to the image is a copy found without reading the file
+  if(link((dir10 + "fii_test_img.png").c_str(), (dir10 + "fii_test_link.png").c_str()) != 0) {
+    std::cerr << "failed to create hardlink test image" << std::endl;
+    return EXIT_FAILURE;
+  }
+  success = test_fii_output("dir10-hardlink-output",
+                            dir10,
+                            {"Found 1 hardlinks to image files (not decoded).",
+                             "Found 1 byte identical copies of image files (not decoded).",
+                             "found 3 identical images"});
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir10-hardlink",
+                            dir10,
+                            "",
+                            {
+                             {"fii_test_dir10-identical.json", 171},
+                             {"fii_test_dir10-identical.csv",  138},
+                            });
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on a folder containing an image, its horizontally flipped copy and
+  // its copy rotated by 90 degrees (i.e. in another bucket)
+  std::string dir11 = fii::create_testdir("fii_test_dir11");
+  {
+    std::mt19937 rand_gen(1777);
+    std::uniform_int_distribution<> rand_pixel(0, 255);
+    int width = 64;
+    int height = 48;
+    int nchannel = 3;
+    std::vector<uint8_t> image_data(width * height * nchannel);
+    for(std::size_t px=0; px<image_data.size(); ++px) {
+      image_data[px] = rand_pixel(rand_gen);
+    }
+    std::vector<uint8_t> flip_data(image_data.size());
+    std::vector<uint8_t> rotate_data(image_data.size());
+    for(int y=0; y<height; ++y) {
+      for(int x=0; x<width; ++x) {
+        for(int c=0; c<nchannel; ++c) {
+          uint8_t value = image_data[(y * width + x) * nchannel + c];
+          flip_data[(y * width + (width - 1 - x)) * nchannel + c] = value;
+          // rotated image is height x width, pixel (x,y) moves to (height-1-y,x)
+          rotate_data[(x * height + (height - 1 - y)) * nchannel + c] = value;
+        }
+      }
+    }
+    std::string img_filename = dir11 + "fii_test_img.png";
+    std::string flip_filename = dir11 + "fii_test_flip.png";
+    std::string rotate_filename = dir11 + "fii_test_rotate.png";
+    if(!stbi_write_png(img_filename.c_str(), width, height, nchannel, image_data.data(), width * nchannel) ||
+       !stbi_write_png(flip_filename.c_str(), width, height, nchannel, flip_data.data(), width * nchannel) ||
+       !stbi_write_png(rotate_filename.c_str(), height, width, nchannel, rotate_data.data(), height * nchannel)) {
+      std::cerr << "failed to write flip and rotate test images" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  success = test_fii_on_dir("dir11-flip-rotate-exact",
+                            dir11,
+                            "",
+                            {});
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir11-flip-rotate",
+                            dir11,
+                            "--flip-rotate ",
+                            {
+                             {"fii_test_dir11-identical.json", 139},
+                             {"fii_test_dir11-identical.csv",  106},
+                            });
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  // test on a folder containing a grayscale image and its copy stored as an
+  // RGB image with all channels equal (i.e. in another bucket)
+  std::string dir12 = fii::create_testdir("fii_test_dir12");
+  {
+    std::mt19937 rand_gen(2903);
+    std::uniform_int_distribution<> rand_pixel(0, 255);
+    int width = 64;
+    int height = 48;
+    std::vector<uint8_t> gray_data(width * height);
+    std::vector<uint8_t> rgb_data(width * height * 3);
+    for(std::size_t px=0; px<gray_data.size(); ++px) {
+      gray_data[px] = rand_pixel(rand_gen);
+      rgb_data[3 * px] = gray_data[px];
+      rgb_data[3 * px + 1] = gray_data[px];
+      rgb_data[3 * px + 2] = gray_data[px];
+    }
+    std::string gray_filename = dir12 + "fii_test_gray.png";
+    std::string rgb_filename = dir12 + "fii_test_rgb.png";
+    if(!stbi_write_png(gray_filename.c_str(), width, height, 1, gray_data.data(), width) ||
+       !stbi_write_png(rgb_filename.c_str(), width, height, 3, rgb_data.data(), width * 3)) {
+      std::cerr << "failed to write grayscale test images" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  success = test_fii_on_dir("dir12-gray-exact",
+                            dir12,
+                            "",
+                            {});
+  if(success != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  success = test_fii_on_dir("dir12-gray",
+                            dir12,
+                            "--match-gray ",
+                            {
+                             {"fii_test_dir12-identical.json", 102},
+                             {"fii_test_dir12-identical.csv",  69},
+                            });
   if(success != EXIT_SUCCESS) {
     return EXIT_FAILURE;
   }
@@ -350,5 +1215,15 @@ int main(int argc, char **argv) {
   fii::remove_testdir("fii_test_dir1");
   fii::remove_testdir("fii_test_dir2");
   fii::remove_testdir("fii_test_dir3");
+  fii::remove_testdir("fii_test_dir4/fii_test_dir5");
+  fii::remove_testdir("fii_test_dir4");
+  fii::remove_testdir("fii_test_dir6");
+  fii::remove_testdir("fii_test_dir7");
+  fii::remove_testdir("fii_test_dir8");
+  fii::remove_testdir("fii_test_dir9");
+  fii::remove_testdir("fii_test_dir10");
+  fii::remove_testdir("fii_test_dir11");
+  fii::remove_testdir("fii_test_dir12");
+  fii::remove_testdir("fii_test_log");
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,101 @@
+/*
+  Disjoint set (union-find) data structure used to find the groups of
+  identical images (i.e. connected components of the match graph).
+
+  The parent of each node is stored in a flat array of atomic values so that
+  multiple threads can merge sets concurrently while they compare images.
+  Set representative is always the node with the smallest index and
+  path halving is used to keep the trees shallow.
+*/
+
+#ifndef FII_UNION_FIND_H
+#define FII_UNION_FIND_H
+
+#include <atomic>
+#include <utility>
+#include <set>
+#include <vector>
+#include <cstdint>
+
+struct fii_union_find {
+  std::vector<std::atomic<uint32_t> > parent;
+};
+
+void fii_union_find_init(fii_union_find &uf,
+                         const uint32_t node_count) {
+  std::vector<std::atomic<uint32_t> > parent(node_count);
+  for(uint32_t i=0; i<node_count; ++i) {
+    parent[i].store(i);
+  }
+  uf.parent.swap(parent);
+}
+
+uint32_t fii_union_find_root(fii_union_find &uf,
+                             uint32_t node) {
+  while(true) {
+    uint32_t p = uf.parent[node].load();
+    if(p == node) {
+      return node;
+    }
+    uint32_t gp = uf.parent[p].load();
+    if(gp != p) {
+      // path halving: gp is always an ancestor of node, therefore a failed
+      // update (due to another thread) does not affect correctness
+      uf.parent[node].compare_exchange_weak(p, gp);
+    }
+    node = gp;
+  }
+}
+
+// can be called concurrently from multiple threads
+void fii_union_find_merge(fii_union_find &uf,
+                          uint32_t a,
+                          uint32_t b) {
+  while(true) {
+    a = fii_union_find_root(uf, a);
+    b = fii_union_find_root(uf, b);
+    if(a == b) {
+      return;
+    }
+    if(a < b) {
+      std::swap(a, b);
+    }
+    // link root with larger index to the root with smaller index
+    uint32_t expected = a;
+    if(uf.parent[a].compare_exchange_strong(expected, b)) {
+      return;
+    }
+  }
+}
+
+// all sets containing more than one node in a single linear pass,
+// node_id[i] is the value stored in the groups for node i
+void fii_union_find_groups(fii_union_find &uf,
+                           const std::vector<uint32_t> &node_id,
+                           std::vector<std::set<uint32_t> > &groups) {
+  groups.clear();
+  uint32_t node_count = uf.parent.size();
+  std::vector<uint32_t> root(node_count);
+  std::vector<uint32_t> set_size(node_count, 0);
+  for(uint32_t i=0; i<node_count; ++i) {
+    root[i] = fii_union_find_root(uf, i);
+    set_size[ root[i] ] += 1;
+  }
+
+  // set representative has the smallest index and therefore, is visited
+  // before other members of its set
+  std::vector<uint32_t> group_index(node_count, node_count);
+  for(uint32_t i=0; i<node_count; ++i) {
+    uint32_t r = root[i];
+    if(set_size[r] < 2) {
+      continue;
+    }
+    if(group_index[r] == node_count) {
+      group_index[r] = groups.size();
+      groups.push_back(std::set<uint32_t>());
+    }
+    groups[ group_index[r] ].insert(node_id[i]);
+  }
+}
+
+#endif
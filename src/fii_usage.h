@@ -2,11 +2,16 @@
 #define FII_USAGE_H
 
 namespace fii {
-  const char *FII_HELP_STR = R"TEXT(Usage: fii [OPTIONS] CHECK_DIR1 [CHECK_DIR2]
+  const char *FII_HELP_STR = R"TEXT(Usage: fii [OPTIONS] CHECK_DIR1 [CHECK_DIR2 ...]
 
 checks if images contained in the CHECK_DIR1 folder have identical copies in the
 CHECK_DIR2 folder. If the optional argument CHECK_DIR2 is undefined, the command
-checks for identical copies within the CHECK_DIR1 folder.
+checks for identical copies within the CHECK_DIR1 folder. If more than two
+folders are provided, identical images between all the folders are reported
+along with the number of images in each folder that have an identical copy in
+another folder (e.g. leakage between train, val and test subsets). A folder
+provided more than once is processed only once and an image file contained in
+nested folders (e.g. a folder and its subfolder) is never matched to itself.
 
 
 The following options are available:
@@ -14,6 +19,41 @@ The following options are available:
 --export[=DIR]     : export results (JSON, CSV, HTML) to this folder
 --nthread[=N]      : use only N threads instead of all available threads
 --check-all-pixels : check every pixel to prevent any false positive (slower)
+--check-tiers=LIST : verify candidates using a comma separated list of tiers
+                     (grid, rowhash, hash, exact), default is hash,exact
+--pixel-cache=MB   : keep at most MB megabytes (default is 512) of pixels decoded
+                     in the first pass so that the candidates are not decoded
+                     again to check all their pixels (0 disables the cache)
+--sample-grid=N    : compare pixel values sampled on a NxN grid in the first pass
+                     (default is 15), smaller grid is faster but may find more
+                     candidates that need to be checked
+--adapt-sampling   : sample the pixel locations that vary the most in a random
+                     subset of images (e.g. images with borders or watermarks)
+--max-pixel-diff=D : find near identical images whose pixel values differ by at
+                     most D (0 to 255), all pixels are always checked (copies
+                     whose 2x2 block averages fall on either side of a
+                     quantisation level are not found)
+--max-diff-fraction=F : allow a fraction F (e.g. 0.01) of pixel values of near
+                     identical images to differ by more than --max-pixel-diff
+--flip-rotate      : also find identical images that are flipped or rotated (by
+                     90, 180 or 270 degrees) copies of each other
+--match-gray       : also match grayscale images stored using three colour
+                     channels with grayscale images (only for one or two
+                     folders)
+--find-resized     : also find resized copies of an image (only for one or two
+                     folders)
+--near-identical   : also find near identical images (e.g. recompressed or
+                     slightly edited copies) using a perceptual hash of images
+                     of any dimension (only for one or two folders)
+--hamming-radius=N : near identical images have perceptual hash that differ in
+                     at most N bits (0 to 16, default is 6)
+--find-crops       : also find images that are exact crops of a larger image
+                     (images that can contain a crop are decoded once more)
+--dir2-filter=FILE : load the filter of CHECK_DIR2 images from FILE (if it
+                     exists) to skip CHECK_DIR2 images that cannot match and
+                     save the updated filter to FILE (the filter is rebuilt
+                     if any file in CHECK_DIR2 was added, removed or changed
+                     or if the tolerance or --flip-rotate changed)
 
 Here are some example commands:
 a) check if the YFCC dataset has images identical to ImageNet dataset
@@ -22,6 +62,9 @@ a) check if the YFCC dataset has images identical to ImageNet dataset
 b) check if the training subset of ImageNet dataset contains identical images
   find-identical-img /dataset/ILSVRC/train/
 
+c) check for leakage between train, val and test subsets of a dataset
+  find-identical-img /dataset/mydata/train/ /dataset/mydata/val/ /dataset/mydata/test/
+
 
 Authors : Abhishek Dutta, Andrew Zisserman
 Contact : {adutta, az} @ robots.ox.ac.uk
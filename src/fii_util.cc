@@ -90,6 +90,15 @@ void fii::fs_list_img_files(const std::string dirpath,
                             std::vector<std::string> &imfn_list,
                             uint32_t &discarded_file_count,
                             std::string filename_prefix) {
+  std::vector<fii::fs_inode> imfn_inode_list;
+  fs_list_img_files(dirpath, imfn_list, imfn_inode_list, discarded_file_count, filename_prefix);
+}
+
+void fii::fs_list_img_files(const std::string dirpath,
+                            std::vector<std::string> &imfn_list,
+                            std::vector<fii::fs_inode> &imfn_inode_list,
+                            uint32_t &discarded_file_count,
+                            std::string filename_prefix) {
   discarded_file_count = 0;
   std::string imfn_regex(".*(.jpg|.jpeg|.png|.bmp|.pnm|.tif)$");
   std::regex filename_regex(imfn_regex,
@@ -110,16 +119,26 @@ void fii::fs_list_img_files(const std::string dirpath,
       continue;
     }
     std::string path = dirpath + name;
-    if(fs_is_dir(path)) {
+    // a single stat() provides both the file type and the inode of a file
+    struct stat path_stat;
+    if(stat(path.c_str(), &path_stat) != 0) {
+      discarded_file_count++;
+      continue;
+    }
+    if(S_ISDIR(path_stat.st_mode)) {
       std::string subdir_name = filename_prefix + name + "/";
       std::string subdirpath = path + "/";
       std::vector<std::string> imfn_sublist;
+      std::vector<fii::fs_inode> imfn_inode_sublist;
       uint32_t subdir_discarded_file_count;
-      fs_list_img_files(subdirpath, imfn_sublist, subdir_discarded_file_count, subdir_name);
+      fs_list_img_files(subdirpath, imfn_sublist, imfn_inode_sublist, subdir_discarded_file_count, subdir_name);
       discarded_file_count += subdir_discarded_file_count;
       imfn_list.insert(imfn_list.end(),
                        std::make_move_iterator(imfn_sublist.begin()),
                        std::make_move_iterator(imfn_sublist.end()));
+      imfn_inode_list.insert(imfn_inode_list.end(),
+                             imfn_inode_sublist.begin(),
+                             imfn_inode_sublist.end());
     } else {
       if( std::regex_match(name, filename_regex) ) {
         if(filename_prefix.empty()) {
@@ -128,6 +147,7 @@ void fii::fs_list_img_files(const std::string dirpath,
           std::string name_with_prefix = filename_prefix + name;
           imfn_list.push_back(name_with_prefix);
         }
+        imfn_inode_list.push_back(fii::fs_inode(path_stat.st_dev, path_stat.st_ino));
       } else {
         discarded_file_count++;
         //std::cout << "discarded: " << name << std::endl;
@@ -207,6 +227,30 @@ std::string fii::fs_dirname(const std::string p) {
   }
 }
 
+// canonical path of a folder (with trailing slash) or empty if it does not exist
+std::string fii::fs_realpath(const std::string p) {
+  char *rp = realpath(p.c_str(), NULL);
+  if(!rp) {
+    return "";
+  }
+  std::string canonical_path(rp);
+  free(rp);
+  if(canonical_path.back() != '/') {
+    canonical_path += "/";
+  }
+  return canonical_path;
+}
+
+// true if both paths refer to the same file or folder (i.e. same device and inode)
+bool fii::fs_is_same_file(const std::string p1, const std::string p2) {
+  struct stat p1_stat;
+  struct stat p2_stat;
+  if(stat(p1.c_str(), &p1_stat) != 0 || stat(p2.c_str(), &p2_stat) != 0) {
+    return false;
+  }
+  return p1_stat.st_dev == p2_stat.st_dev && p1_stat.st_ino == p2_stat.st_ino;
+}
+
 std::string fii::fs_file_extension(const std::string p) {
   std::size_t last_dot_index = p.rfind(".");
   if(last_dot_index == std::string::npos) {
@@ -450,8 +494,8 @@ void fii::split(const std::string &s,
   chunks.clear();
   std::vector<uint32_t> seperator_index_list;
 
-  uint32_t start = 0;
-  uint32_t sep_index;
+  std::size_t start = 0;
+  std::size_t sep_index;
   while ( start < s.length() ) {
     sep_index = s.find(separator, start);
     if ( sep_index == std::string::npos ) {
@@ -9,6 +9,8 @@ Author: Abhishek Dutta <http://abhishekdutta.org>
 
 #include <string>
 #include <vector>
+#include <utility>
+#include <cstdint>
 #include <unordered_map>
 #include <iostream>
 #include <sys/stat.h>
@@ -21,6 +23,10 @@ Author: Abhishek Dutta <http://abhishekdutta.org>
 #include <cstdlib>
 
 namespace fii {
+  // device and inode number (i.e. st_dev, st_ino) identify a file irrespective
+  // of the path (e.g. hardlink) used to reach it
+  typedef std::pair<uint64_t, uint64_t> fs_inode;
+
   void parse_command_line_args(int argc,
                                char **argv,
                                std::unordered_map<std::string, std::string> &options,
@@ -36,12 +42,19 @@ namespace fii {
                          std::vector<std::string> &fn_list,
                          uint32_t &discarded_file_count,
                          std::string filename_prefix="");
+  void fs_list_img_files(const std::string target_dir,
+                         std::vector<std::string> &fn_list,
+                         std::vector<fs_inode> &fn_inode_list,
+                         uint32_t &discarded_file_count,
+                         std::string filename_prefix="");
   void fs_list_all_files(const std::string target_dir,
                          std::vector<std::string> &fn_list,
                          std::string filename_prefix="");
 
   bool fs_load_file(const std::string fn, std::string& file_content);
   std::string fs_dirname(const std::string p);
+  std::string fs_realpath(const std::string p);
+  bool fs_is_same_file(const std::string p1, const std::string p2);
   std::string fs_file_extension(const std::string p);
 
   // homedir and subdirs